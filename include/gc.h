@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 
 #ifdef __cplusplus
 extern "C" {
@@ -22,19 +23,113 @@ void *gc_malloc(size_t size, FinalizerT finalizer);
 void *gc_malloc_default(size_t size);
 void *gc_calloc(size_t nmemb, size_t size, FinalizerT finalizer);
 void *gc_calloc_default(size_t nmemb, size_t size);
+// returns NULL and leaves the memory alone if ptr is not the start of an object of the collector
 void *gc_realloc(void *ptr, size_t size, FinalizerT finalizer);
 void *gc_realloc_default(void *ptr, size_t size);
 void gc_free(void *ptr);
 void gc_free_all();
 
+// Typed allocation, the collector scans only the words the descriptor declares as pointers.
+// Bit i % 64 of bitmap[i / 64] is set if word i of the type may hold a pointer. Objects longer
+// than num_words repeat the layout, so arrays of the type share its descriptor. Descriptors live
+// until the program exits. gc_realloc returns an object that is scanned as a whole again
+typedef struct GCLayout GCLayout;
+typedef const GCLayout *GCDescriptor;
+GCDescriptor gc_make_descriptor(const uint64_t *bitmap, size_t num_words);
+void *gc_malloc_typed(size_t size, GCDescriptor descriptor, FinalizerT finalizer);
+// memory that never holds pointers, numeric buffers or strings, it is never scanned
+void *gc_malloc_atomic(size_t size, FinalizerT finalizer);
+
 // trigger garbage collecting
 void gc_collect();
 void gc_wait_collect();
+// also waits for the background sweep and the finalizers of the collection
 void gc_collect_blocked();
 
+// background sweeping, collections resume the world right after marking and dead objects are
+// finalized and freed by a sweeper thread. Finalizers run on that thread then
+void gc_enable_background_sweep();
+void gc_disable_background_sweep();
+// returns once the objects found dead by the last collection are finalized and freed
+void gc_wait_sweep();
+
+// asynchronous finalization, finalizers of dead objects run in batches on an executor thread
+// after the world resumes and their memory is freed once they are done. Objects without a
+// finalizer are still freed by the sweep
+void gc_enable_async_finalizers();
+void gc_disable_async_finalizers();
+// runs the queued finalizers on the calling thread, returns how many it ran
+size_t gc_run_finalizers();
+size_t gc_pending_finalizers();
+// the executor hands the collector lock back after running finalizers for this long
+void gc_set_finalizer_batch_time(uint64_t ns);
+uint64_t gc_get_finalizer_batch_time();
+
+// generational mode, collections triggered by the scheduler are mostly minor then
+void gc_enable_generational();
+void gc_disable_generational();
+// frees only objects allocated since the last collection, old objects stay marked
+void gc_collect_minor();
+// must follow every store of a pointer into slot, a field of the object obj
+void gc_write_barrier(void *obj, void *slot);
+
+// concurrent marking, full collections trace the heap while mutators run, between a pause that
+// scans the roots and a remark pause. Dead objects are swept in the background then
+void gc_enable_concurrent_mark();
+void gc_disable_concurrent_mark();
+// must precede every store of a pointer into slot while concurrent marking is enabled, the
+// pointer held there before stays alive for the running collection
+void gc_write_barrier_pre(void *slot);
+
+// concurrent marking without a write barrier, the kernel tracks the pages written while marking
+// runs, through soft-dirty bits or userfaultfd write protection, and the remark pause scans the
+// roots and those pages again. Returns 0 and changes nothing if the kernel supports neither
+int gc_enable_dirty_page_mark();
+void gc_disable_dirty_page_mark();
+
+// incremental collection driven by the application, every call spends about budget_us on the
+// current cycle and starts one if there is none. The application runs between the calls of a
+// cycle, so stores of pointers need gc_write_barrier_pre as with concurrent marking, unless
+// dirty page marking is enabled. Returns 1 once the cycle is marked and swept, 0 while work is
+// left or while a collection runs on another thread
+int gc_step(uint64_t budget_us);
+
+// threads taking part in a collection, the collecting thread included. 0 is one per core
+void gc_set_worker_threads(size_t count);
+size_t gc_get_worker_threads();
+// pins the helper threads to the given cpus, an empty set lets them run anywhere. A thread that
+// runs a whole collection is pinned to them too until it is done, gc_step leaves its caller alone
+void gc_set_worker_affinity(const int *cpus, size_t num_cpus);
+
+typedef struct GCStats {
+    size_t minor_collections;
+    size_t full_collections;
+    uint64_t last_minor_pause_ns;
+    uint64_t last_full_pause_ns;
+    uint64_t total_minor_pause_ns;
+    uint64_t total_full_pause_ns;
+    // from the stop request until every registered thread stopped or was blocked
+    uint64_t last_time_to_safepoint_ns;
+    uint64_t max_time_to_safepoint_ns;
+} GCStats;
+
+void gc_get_stats(GCStats *stats);
+
 // root managing
 void gc_add_root(GCRoot root);
 void gc_delete_root(GCRoot root);
+// Roots registered by handle, both calls are O(1) and don't wait for a collection,
+// gc_unregister_root only waits while one scans the roots. A root registered with
+// GC_ROOT_HINTED is scanned in full only after gc_root_changed, other collections scan the words
+// that pointed into the heap at the last full scan. Hinted roots are changed by registered
+// threads, which call gc_root_changed after the stores and before their next call into the
+// collector. Collections that stop threads with signals scan them in full
+typedef struct GCRootEntry GCRootEntry;
+typedef GCRootEntry *GCRootHandle;
+enum { GC_ROOT_HINTED = 1 };
+GCRootHandle gc_register_root(void *addr, size_t size, int flags);
+void gc_unregister_root(GCRootHandle root);
+void gc_root_changed(GCRootHandle root);
 
 // managing for params of scheduler
 size_t gc_get_bytes_threshold();
@@ -48,9 +143,24 @@ void gc_disable_auto();
 void gc_enable_auto();
 
 // threads safety
+// On Linux a plain load from a page that collections protect while they stop the world, the
+// fault parks the thread. The collector takes SIGSEGV at startup and passes other faults to the
+// handler installed before, a handler installed later must pass faults on in the same way
 void gc_safepoint();
 void gc_register_thread();
 void gc_deregister_thread();
+// a registered thread about to block, in a system call or on a lock, counts as stopped until
+// gc_leave_blocking, which waits while a collection runs. The thread must not touch collected
+// memory or call into the collector in between
+void gc_enter_blocking();
+void gc_leave_blocking();
+// stacks and registers of registered threads become roots, collections stop the threads with
+// signals wherever they are instead of waiting for gc_safepoint. Registered threads must
+// deregister before they exit. A stopped thread may hold a lock of malloc, so the collector
+// neither allocates nor frees while threads are stopped: it only marks then, and sweeps and runs
+// finalizers once they run again. Returns 0 if the signals can't be installed
+int gc_enable_stack_roots();
+void gc_disable_stack_roots();
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "gc.h"
 #include "gc_impl.h"
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
@@ -8,7 +9,7 @@
 static std::unique_ptr<GCImpl> gc_instance = std::make_unique<GCImpl>();
 
 Allocation ToAllocation(void* addr, size_t size) {
-    return Allocation{reinterpret_cast<uintptr_t>(addr), size, BasicFinalizer, 0};   
+    return Allocation{reinterpret_cast<uintptr_t>(addr), size, BasicFinalizer};
 }
 
 #ifdef __cplusplus
@@ -62,6 +63,18 @@ void gc_free_all() {
     gc_instance->FreeAll();
 }
 
+GCDescriptor gc_make_descriptor(const uint64_t* bitmap, size_t num_words) {
+    return gc_instance->MakeLayout(bitmap, num_words);
+}
+
+void* gc_malloc_typed(size_t size, GCDescriptor descriptor, FinalizerT finalizer) {
+    return gc_instance->Malloc(size, finalizer, descriptor);
+}
+
+void* gc_malloc_atomic(size_t size, FinalizerT finalizer) {
+    return gc_instance->Malloc(size, finalizer, &kPointerFreeLayout);
+}
+
 void gc_collect() {
     gc_instance->GetScheduler().TriggerCollect();
 }
@@ -73,6 +86,100 @@ void gc_wait_collect() {
 void gc_collect_blocked() {
     gc_collect();
     gc_wait_collect();
+    gc_wait_sweep();
+    gc_run_finalizers();
+}
+
+void gc_enable_background_sweep() {
+    gc_instance->SetBackgroundSweep(true);
+}
+
+void gc_disable_background_sweep() {
+    gc_instance->SetBackgroundSweep(false);
+}
+
+void gc_wait_sweep() {
+    gc_instance->WaitSweep();
+}
+
+void gc_enable_async_finalizers() {
+    gc_instance->SetAsyncFinalizers(true);
+}
+
+void gc_disable_async_finalizers() {
+    gc_instance->SetAsyncFinalizers(false);
+}
+
+size_t gc_run_finalizers() {
+    return gc_instance->GetFinalizerExecutor().RunPending();
+}
+
+size_t gc_pending_finalizers() {
+    return gc_instance->GetFinalizerExecutor().NumPending();
+}
+
+void gc_set_finalizer_batch_time(uint64_t ns) {
+    gc_instance->GetFinalizerExecutor().SetBatchTime(std::chrono::nanoseconds(ns));
+}
+
+uint64_t gc_get_finalizer_batch_time() {
+    return gc_instance->GetFinalizerExecutor().GetBatchTime().count();
+}
+
+void gc_enable_generational() {
+    gc_instance->SetGenerational(true);
+}
+
+void gc_disable_generational() {
+    gc_instance->SetGenerational(false);
+}
+
+void gc_collect_minor() {
+    gc_instance->GetScheduler().TriggerCollect(CollectionKind::kMinor);
+}
+
+void gc_write_barrier(void*, void* slot) {
+    gc_instance->WriteBarrier(reinterpret_cast<uintptr_t>(slot));
+}
+
+void gc_enable_concurrent_mark() {
+    gc_instance->SetConcurrentMark(true);
+}
+
+void gc_disable_concurrent_mark() {
+    gc_instance->SetConcurrentMark(false);
+}
+
+void gc_write_barrier_pre(void* slot) {
+    gc_instance->WriteBarrierPre(reinterpret_cast<uintptr_t>(slot));
+}
+
+int gc_enable_dirty_page_mark() {
+    return gc_instance->SetDirtyPageMark(true) ? 1 : 0;
+}
+
+void gc_disable_dirty_page_mark() {
+    gc_instance->SetDirtyPageMark(false);
+}
+
+int gc_step(uint64_t budget_us) {
+    return gc_instance->Step(std::chrono::microseconds(budget_us)) ? 1 : 0;
+}
+
+void gc_set_worker_threads(size_t count) {
+    gc_instance->SetWorkerThreads(count);
+}
+
+size_t gc_get_worker_threads() {
+    return gc_instance->GetWorkerThreads();
+}
+
+void gc_set_worker_affinity(const int* cpus, size_t num_cpus) {
+    gc_instance->SetWorkerAffinity(std::vector<int>(cpus, cpus + num_cpus));
+}
+
+void gc_get_stats(GCStats* stats) {
+    *stats = gc_instance->GetStats();
 }
 
 void gc_add_root(GCRoot root) {
@@ -83,6 +190,19 @@ void gc_delete_root(GCRoot root) {
     gc_instance->DeleteRoot(ToAllocation(root.addr, root.size));
 }
 
+GCRootHandle gc_register_root(void* addr, size_t size, int flags) {
+    return gc_instance->RegisterRoot(reinterpret_cast<uintptr_t>(addr), size,
+                                     (flags & GC_ROOT_HINTED) != 0);
+}
+
+void gc_unregister_root(GCRootHandle root) {
+    gc_instance->UnregisterRoot(root);
+}
+
+void gc_root_changed(GCRootHandle root) {
+    gc_instance->RootChanged(root);
+}
+
 size_t gc_get_bytes_threshold() {
     return gc_instance->GetScheduler().GetThresholdBytes();
 }
@@ -130,6 +250,22 @@ void gc_deregister_thread() {
     gc_instance->DeregisterThread();
 }
 
+void gc_enter_blocking() {
+    gc_instance->EnterBlocking();
+}
+
+void gc_leave_blocking() {
+    gc_instance->LeaveBlocking();
+}
+
+int gc_enable_stack_roots() {
+    return gc_instance->SetStackRoots(true) ? 1 : 0;
+}
+
+void gc_disable_stack_roots() {
+    gc_instance->SetStackRoots(false);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,50 @@
+#include "gc_allocation_index.h"
+#include <algorithm>
+
+void AllocationIndex::Clear() {
+    tree_.clear();
+    nodes_.clear();
+    sorted_starts_.clear();
+    sorted_ends_.clear();
+    last_start_ = last_end_ = 0;
+    last_rank_ = 0;
+    min_addr_ = UINTPTR_MAX;
+    max_addr_ = 0;
+}
+
+void AllocationIndex::BuildTree() {
+    size_t count = sorted_starts_.size();
+    tree_.resize(count + 1);
+    nodes_.resize(count + 1);
+    FillTree(1, 0);
+    last_start_ = last_end_ = 0;
+    min_addr_ = count == 0 ? UINTPTR_MAX : sorted_starts_.front();
+    max_addr_ = count == 0 ? 0 : sorted_ends_.back();
+}
+
+// in-order walk of the implicit tree hands out sorted elements
+size_t AllocationIndex::FillTree(size_t node, size_t rank) {
+    if (node >= tree_.size()) {
+        return rank;
+    }
+    rank = FillTree(2 * node, rank);
+    tree_[node] = sorted_starts_[rank];
+    nodes_[node] = Node{sorted_ends_[rank], rank};
+    return FillTree(2 * node + 1, rank + 1);
+}
+
+// node with the last start <= ptr, 0 if there is none
+size_t AllocationIndex::Predecessor(uintptr_t ptr) const {
+    const uintptr_t* tree = tree_.data();
+    size_t count = tree_.size() - 1;
+    size_t node = 1, found = 0;
+    while (node <= count) {
+        // 16 descendants four levels down fill two cache lines
+        __builtin_prefetch(tree + std::min(node * 16, count));
+        __builtin_prefetch(tree + std::min(node * 16 + 8, count));
+        bool right = tree[node] <= ptr;
+        found = right ? node : found;
+        node = 2 * node + right;
+    }
+    return found;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Read-only search structure over a sorted set of [start, end) ranges. Starts are stored in
+// Eytzinger (BFS) order, so a lookup walks the array front to back and the first levels of the
+// implicit tree share a few cache lines. End and sorted rank of every node sit in a parallel
+// array, so a hit costs one more cache line.
+class AllocationIndex {
+public:
+    static constexpr size_t kNotFound = SIZE_MAX;
+
+    // ranges must be sorted by ptr and must not overlap
+    template <typename Range>
+    void Build(const std::vector<Range>& sorted);
+    void Clear();
+
+    size_t Size() const {
+        return tree_.empty() ? 0 : tree_.size() - 1;
+    }
+
+    // returns sorted rank of the range that contains ptr or kNotFound
+    size_t Find(uintptr_t ptr) {
+        if (ptr < min_addr_ || ptr >= max_addr_) {
+            return kNotFound;
+        }
+        // pointers into the same object tend to come together
+        if (last_start_ <= ptr && ptr < last_end_) {
+            return last_rank_;
+        }
+        size_t node = Predecessor(ptr);
+        if (node == 0 || ptr >= nodes_[node].end) {
+            return kNotFound;
+        }
+        last_start_ = tree_[node];
+        last_end_ = nodes_[node].end;
+        last_rank_ = nodes_[node].rank;
+        return last_rank_;
+    }
+
+private:
+    struct Node {
+        uintptr_t end;
+        size_t rank;
+    };
+
+    void BuildTree();
+    size_t FillTree(size_t node, size_t rank);
+    size_t Predecessor(uintptr_t ptr) const;
+
+    // both are 1-based, node 0 means none
+    std::vector<uintptr_t> tree_;
+    std::vector<Node> nodes_;
+    // sorted input, kept between builds to save allocations
+    std::vector<uintptr_t> sorted_starts_;
+    std::vector<uintptr_t> sorted_ends_;
+    uintptr_t last_start_ = 0, last_end_ = 0;
+    size_t last_rank_ = 0;
+    uintptr_t min_addr_ = UINTPTR_MAX;
+    uintptr_t max_addr_ = 0;
+};
+
+template <typename Range>
+void AllocationIndex::Build(const std::vector<Range>& sorted) {
+    sorted_starts_.resize(sorted.size());
+    sorted_ends_.resize(sorted.size());
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        sorted_starts_[i] = sorted[i].ptr;
+        sorted_ends_[i] = sorted[i].ptr + sorted[i].size;
+    }
+    BuildTree();
+}
@@ -0,0 +1,232 @@
+#include "gc_allocation_table.h"
+#include <algorithm>
+
+static bool PtrLess(const Allocation& lhs, const Allocation& rhs) {
+    return lhs.ptr < rhs.ptr;
+}
+
+void AllocationTable::Insert(const Allocation& alloc) {
+    pending_.push_back(alloc);
+    if (pending_.size() >= kAllocationRunCapacity) {
+        Seal();
+    }
+}
+
+void AllocationTable::Seal() {
+    if (pending_.empty()) {
+        return;
+    }
+    std::unique_ptr<AllocationRun> run = NewRun();
+    run->entries.swap(pending_);
+    std::sort(run->entries.begin(), run->entries.end(), PtrLess);
+    // new entries are young, they are unmarked until a collection proves them alive
+    size_t count = run->entries.size();
+    run->marks.assign((count + 63) / 64, allocate_marked_ ? ~uint64_t{0} : 0);
+    if (allocate_marked_ && count % 64 != 0) {
+        run->marks.back() = (uint64_t{1} << (count % 64)) - 1;
+    }
+    run->index.Build(run->entries);
+    runs_.push_back(std::move(run));
+    pending_.reserve(kAllocationRunCapacity);
+    MergeNewest();
+    if (runs_.size() > MaxRuns()) {
+        Compact();
+    }
+}
+
+bool AllocationTable::FindSlow(uintptr_t ptr, AllocationRef* ref) {
+    // oldest runs are the biggest ones. An erased entry may still cover ptr in one run while a
+    // live one covers it in another
+    for (const auto& run : runs_) {
+        size_t rank = run->index.Find(ptr);
+        if (rank != AllocationIndex::kNotFound && run->entries[rank].size != 0) {
+            *ref = AllocationRef{run.get(), rank};
+            last_ = *ref;
+            last_start_ = run->entries[rank].ptr;
+            last_end_ = last_start_ + run->entries[rank].size;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AllocationTable::Lookup(uintptr_t ptr, Allocation* found) {
+    auto it = std::find_if(pending_.begin(), pending_.end(), [ptr](const Allocation& alloc) {
+        return alloc.ptr <= ptr && ptr < alloc.ptr + alloc.size;
+    });
+    if (it != pending_.end()) {
+        *found = *it;
+        return true;
+    }
+    AllocationRef ref;
+    if (!Find(ptr, &ref)) {
+        return false;
+    }
+    *found = ref.Get();
+    return true;
+}
+
+bool AllocationTable::Erase(uintptr_t ptr, Allocation* erased) {
+    auto contains = [ptr](const Allocation& alloc) {
+        return alloc.ptr <= ptr && ptr < alloc.ptr + alloc.size;
+    };
+    auto it = std::find_if(pending_.begin(), pending_.end(), contains);
+    if (it != pending_.end()) {
+        *erased = *it;
+        *it = pending_.back();
+        pending_.pop_back();
+        return true;
+    }
+    AllocationRef ref;
+    if (!Find(ptr, &ref)) {
+        return false;
+    }
+    ResetLastHit();
+    Allocation& alloc = ref.run->entries[ref.rank];
+    *erased = alloc;
+    alloc.size = 0;
+    ref.run->marks[ref.rank / 64] &= ~(uint64_t{1} << (ref.rank % 64));
+    return true;
+}
+
+void AllocationTable::Clear() {
+    ResetLastHit();
+    pending_.clear();
+    runs_.clear();
+    spare_runs_.clear();
+}
+
+void AllocationTable::ClearMarks() {
+    for (const auto& run : runs_) {
+        std::fill(run->marks.begin(), run->marks.end(), 0);
+    }
+}
+
+std::unique_ptr<AllocationRun> AllocationTable::NewRun() {
+    if (spare_runs_.empty()) {
+        return std::make_unique<AllocationRun>();
+    }
+    std::unique_ptr<AllocationRun> run = std::move(spare_runs_.back());
+    spare_runs_.pop_back();
+    run->entries.clear();
+    return run;
+}
+
+void AllocationTable::RetireRun(std::unique_ptr<AllocationRun> run) {
+    spare_runs_.push_back(std::move(run));
+}
+
+// merges runs_[older + 1] into runs_[older], erased entries are dropped and marks move along
+void AllocationTable::MergeRuns(size_t older) {
+    const AllocationRun& lhs = *runs_[older];
+    const AllocationRun& rhs = *runs_[older + 1];
+    std::unique_ptr<AllocationRun> merged = NewRun();
+    std::vector<Allocation>& entries = merged->entries;
+    std::vector<uint64_t>& marks = merged->marks;
+    marks.assign((lhs.entries.size() + rhs.entries.size() + 63) / 64, 0);
+    entries.reserve(lhs.entries.size() + rhs.entries.size());
+    size_t i = 0, j = 0;
+    while (i < lhs.entries.size() || j < rhs.entries.size()) {
+        bool take_lhs = j == rhs.entries.size() ||
+                        (i < lhs.entries.size() && lhs.entries[i].ptr < rhs.entries[j].ptr);
+        const AllocationRun& source = take_lhs ? lhs : rhs;
+        size_t rank = take_lhs ? i++ : j++;
+        if (source.entries[rank].size == 0) {
+            continue;
+        }
+        if ((source.marks[rank / 64] >> (rank % 64)) & 1) {
+            marks[entries.size() / 64] |= uint64_t{1} << (entries.size() % 64);
+        }
+        entries.push_back(source.entries[rank]);
+    }
+    marks.resize((entries.size() + 63) / 64);
+    merged->index.Build(entries);
+    RetireRun(std::move(runs_[older]));
+    RetireRun(std::move(runs_[older + 1]));
+    runs_[older] = std::move(merged);
+    runs_.erase(runs_.begin() + older + 1);
+}
+
+// merges the newest runs while they are too close in size and the merge stays small
+void AllocationTable::MergeNewest() {
+    while (runs_.size() > 1) {
+        size_t older = runs_.size() - 2;
+        size_t older_size = runs_[older]->entries.size();
+        size_t newer_size = runs_.back()->entries.size();
+        if (older_size >= kAllocationRunGrowth * newer_size ||
+            older_size + newer_size > kSealMergeEntries) {
+            return;
+        }
+        ResetLastHit();
+        MergeRuns(older);
+    }
+}
+
+// twice the runs Compact leaves at most, so it runs once per O(log n) big runs
+size_t AllocationTable::MaxRuns() const {
+    size_t entries = 0;
+    for (const auto& run : runs_) {
+        entries += run->entries.size();
+    }
+    return 2 * std::bit_width(entries);
+}
+
+// restores the size invariant, after a sweep any pair of neighbours may violate it
+void AllocationTable::Compact() {
+    ResetLastHit();
+    for (auto& run : runs_) {
+        if (run->entries.empty()) {
+            RetireRun(std::move(run));
+        }
+    }
+    std::erase(runs_, nullptr);
+    for (size_t i = runs_.size(); i-- > 1;) {
+        if (runs_[i - 1]->entries.size() < kAllocationRunGrowth * runs_[i]->entries.size()) {
+            MergeRuns(i - 1);
+            i = runs_.size();
+        }
+    }
+}
+
+size_t AllocationTable::PrepareSweep() {
+    ResetLastHit();
+    sweep_chunks_.clear();
+    for (const auto& run : runs_) {
+        size_t live = 0;
+        for (uint64_t word : run->marks) {
+            live += std::popcount(word);
+        }
+        // erased entries are never marked, so a fully marked run has nothing to free
+        if (live == run->entries.size()) {
+            continue;
+        }
+        for (size_t begin = 0; begin < run->entries.size(); begin += kSweepChunkEntries) {
+            sweep_chunks_.push_back(EntryRange{
+                run.get(), begin, std::min(begin + kSweepChunkEntries, run->entries.size())});
+        }
+    }
+    return sweep_chunks_.size();
+}
+
+// the survivors of a run are moved down over the gaps the dead entries left between chunks
+void AllocationTable::FinishSweep() {
+    for (size_t i = 0; i < sweep_chunks_.size();) {
+        AllocationRun* run = sweep_chunks_[i].run;
+        std::vector<Allocation>& entries = run->entries;
+        size_t live = 0;
+        for (; i < sweep_chunks_.size() && sweep_chunks_[i].run == run; ++i) {
+            const EntryRange& chunk = sweep_chunks_[i];
+            std::copy(entries.begin() + chunk.begin, entries.begin() + chunk.begin + chunk.live,
+                      entries.begin() + live);
+            live += chunk.live;
+        }
+        entries.resize(live);
+        run->marks.assign((live + 63) / 64, ~uint64_t{0});
+        if (live % 64 != 0) {
+            run->marks.back() = (uint64_t{1} << (live % 64)) - 1;
+        }
+        run->index.Build(entries);
+    }
+    sweep_chunks_.clear();
+    Compact();
+}
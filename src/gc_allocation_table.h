@@ -0,0 +1,197 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "gc.h"
+#include "gc_allocation_index.h"
+
+struct Allocation {
+    uintptr_t ptr;
+    size_t size;
+    FinalizerT finalizer;
+    const GCLayout* layout = nullptr;  // nullptr is scanned conservatively
+};
+
+constexpr size_t kAllocationRunCapacity = 1024;  // new allocations sealed into one run
+constexpr size_t kAllocationRunGrowth = 2;       // each run is at least this much bigger than the next
+constexpr size_t kSweepChunkEntries = 4096;       // entries a sweep worker takes at once
+// entries a seal merges at most, bigger merges wait for the next sweep
+constexpr size_t kSealMergeEntries = 16 * kAllocationRunCapacity;
+
+// Sorted batch of allocations with its own search index and mark bits. Entries never move
+// while the run lives, erased ones are left in place with size 0 until the next sweep.
+struct AllocationRun {
+    std::vector<Allocation> entries;
+    std::vector<uint64_t> marks;
+    AllocationIndex index;
+};
+
+struct AllocationRef {
+    AllocationRun* run = nullptr;
+    size_t rank = 0;
+
+    const Allocation& Get() const {
+        return run->entries[rank];
+    }
+    bool operator==(const AllocationRef&) const = default;
+};
+
+// Log-structured table of medium allocations. New entries collect in a small unsorted buffer
+// that is sealed into a sorted run when it fills or a collection starts. Runs shrink
+// geometrically from oldest to newest, and a run is merged into its older neighbour once it
+// gets too close to it in size, so there are O(log n) runs and a collection on a mostly static
+// heap doesn't move or re-sort old entries. A seal only merges the small newest runs, so the
+// runs too big for it pile up until there are more than 2 log2 n of them, and the seal that
+// passes that merges them all at once. Not thread-safe, callers serialize access.
+class AllocationTable {
+public:
+    void Insert(const Allocation& alloc);
+    // makes all inserted entries visible to Find
+    void Seal();
+    bool Find(uintptr_t ptr, AllocationRef* ref) {
+        // pointers into the same object tend to come together
+        if (last_.run != nullptr && last_start_ <= ptr && ptr < last_end_) {
+            *ref = last_;
+            return true;
+        }
+        return FindSlow(ptr, ref);
+    }
+    // the allocation containing ptr, sealed or not
+    bool Lookup(uintptr_t ptr, Allocation* found);
+    // removes the allocation containing ptr, sealed or not
+    bool Erase(uintptr_t ptr, Allocation* erased);
+    void Clear();
+
+    void ClearMarks();
+    // entries sealed while set start out marked, as objects allocated while marking runs
+    // concurrently must survive it
+    void SetAllocateMarked(bool marked) {
+        allocate_marked_ = marked;
+    }
+    static bool IsMarked(AllocationRef ref) {
+        uint64_t word = std::atomic_ref<uint64_t>(ref.run->marks[ref.rank / 64])
+                            .load(std::memory_order_relaxed);
+        return (word >> (ref.rank % 64)) & 1;
+    }
+    // returns true if the allocation was not marked before
+    static bool TestAndMark(AllocationRef ref) {
+        uint64_t bit = uint64_t{1} << (ref.rank % 64);
+        std::atomic_ref<uint64_t> word(ref.run->marks[ref.rank / 64]);
+        if (word.load(std::memory_order_relaxed) & bit) {
+            return false;
+        }
+        return !(word.fetch_or(bit, std::memory_order_relaxed) & bit);
+    }
+
+    // Marks the entries that contain any of the sorted addresses and calls on_marked for those
+    // that weren't marked before. Every run is merge-joined with the addresses in one pass,
+    // galloping over the entries between two neighbouring addresses.
+    template <typename Callback>
+    void MarkSorted(const uintptr_t* addrs, size_t count, Callback on_marked);
+
+    // Sweep in three steps, so that the chunks can be swept by several threads. PrepareSweep
+    // returns the number of chunks, SweepChunk compacts the survivors of one chunk in place and
+    // may run concurrently for different chunks, FinishSweep joins the chunks of every run
+    size_t PrepareSweep();
+    template <typename Callback>
+    void SweepChunk(size_t index, Callback on_dead);
+    void FinishSweep();
+    template <typename Callback>
+    void ForEach(Callback callback) const;
+
+    size_t NumRuns() const {
+        return runs_.size();
+    }
+
+private:
+    struct EntryRange {
+        AllocationRun* run;
+        size_t begin, end;
+        size_t live = 0;  // survivors moved to the front of the range
+    };
+
+    void MergeRuns(size_t older);
+    void MergeNewest();
+    size_t MaxRuns() const;
+    void Compact();
+    std::unique_ptr<AllocationRun> NewRun();
+    void RetireRun(std::unique_ptr<AllocationRun> run);
+    bool FindSlow(uintptr_t ptr, AllocationRef* ref);
+    void ResetLastHit() {
+        last_ = AllocationRef{};
+    }
+
+    std::vector<Allocation> pending_;
+    std::vector<std::unique_ptr<AllocationRun>> runs_;  // oldest first
+    // Buffers of merged runs are kept for reuse. Given back to malloc they would soon hold
+    // medium objects, and the stale addresses in them would be scanned as pointers
+    std::vector<std::unique_ptr<AllocationRun>> spare_runs_;
+    std::vector<EntryRange> sweep_chunks_;
+    AllocationRef last_;
+    uintptr_t last_start_ = 0, last_end_ = 0;
+    bool allocate_marked_ = false;
+};
+
+template <typename Callback>
+void AllocationTable::MarkSorted(const uintptr_t* addrs, size_t count, Callback on_marked) {
+    for (const auto& run : runs_) {
+        const std::vector<Allocation>& entries = run->entries;
+        size_t rank = 0;  // first entry that may contain the current address
+        for (size_t i = 0; i < count && rank < entries.size(); ++i) {
+            uintptr_t addr = addrs[i];
+            if (addr < entries[rank].ptr) {
+                continue;
+            }
+            // find the last entry starting at or before addr, the step doubles as we go
+            size_t step = 1;
+            while (rank + step < entries.size() && entries[rank + step].ptr <= addr) {
+                rank += step;
+                step *= 2;
+            }
+            while (step > 1) {
+                step /= 2;
+                if (rank + step < entries.size() && entries[rank + step].ptr <= addr) {
+                    rank += step;
+                }
+            }
+            const Allocation& alloc = entries[rank];
+            if (addr < alloc.ptr + alloc.size && TestAndMark(AllocationRef{run.get(), rank})) {
+                on_marked(alloc);
+            }
+        }
+    }
+}
+
+template <typename Callback>
+void AllocationTable::SweepChunk(size_t index, Callback on_dead) {
+    EntryRange& chunk = sweep_chunks_[index];
+    std::vector<Allocation>& entries = chunk.run->entries;
+    const std::vector<uint64_t>& marks = chunk.run->marks;
+    size_t live = chunk.begin;
+    for (size_t i = chunk.begin; i < chunk.end; ++i) {
+        if ((marks[i / 64] >> (i % 64)) & 1) {
+            entries[live++] = entries[i];
+        } else if (entries[i].size != 0) {
+            on_dead(entries[i]);
+        }
+    }
+    chunk.live = live - chunk.begin;
+}
+
+template <typename Callback>
+void AllocationTable::ForEach(Callback callback) const {
+    for (const auto& run : runs_) {
+        for (const Allocation& alloc : run->entries) {
+            if (alloc.size != 0) {
+                callback(alloc);
+            }
+        }
+    }
+    for (const Allocation& alloc : pending_) {
+        callback(alloc);
+    }
+}
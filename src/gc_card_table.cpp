@@ -0,0 +1,48 @@
+#include "gc_card_table.h"
+#include <sys/mman.h>
+#include <algorithm>
+#include <cstring>
+
+CardTable::CardTable() : regions_(std::make_unique<std::atomic<Region*>[]>(kCardRegions)) {
+}
+
+CardTable::~CardTable() {
+    for (size_t region : covered_) {
+        munmap(regions_[region].load(), sizeof(Region));
+    }
+}
+
+void CardTable::Cover(uintptr_t start, size_t size) {
+    size_t first = start >> kCardRegionShift;
+    size_t last = std::min((start + size - 1) >> kCardRegionShift, kCardRegions - 1);
+    for (size_t region = first; region <= last; ++region) {
+        if (regions_[region].load(std::memory_order_acquire) != nullptr) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(covering_);
+        if (regions_[region].load(std::memory_order_relaxed) != nullptr) {
+            continue;
+        }
+        // untouched card pages stay unbacked
+        void* mem = mmap(nullptr, sizeof(Region), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED) {
+            throw std::bad_alloc{};
+        }
+        regions_[region].store(static_cast<Region*>(mem), std::memory_order_release);
+        covered_.push_back(region);
+    }
+}
+
+void CardTable::Clear() {
+    for (size_t region : covered_) {
+        Region* cards = regions_[region].load(std::memory_order_relaxed);
+        for (size_t chunk = 0; chunk < kCardChunks; ++chunk) {
+            if (cards->chunks[chunk]) {
+                cards->chunks[chunk] = 0;
+                std::memset(cards->cards + (chunk << kCardChunkShift), 0,
+                            size_t{1} << kCardChunkShift);
+            }
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+constexpr size_t kCardShift = 9;
+constexpr size_t kCardSize = size_t{1} << kCardShift;
+constexpr size_t kCardRegionShift = 30;
+constexpr size_t kCardsPerRegion = size_t{1} << (kCardRegionShift - kCardShift);
+constexpr size_t kCardRegions = size_t{1} << (47 - kCardRegionShift);
+// a summary byte per chunk of cards lets minor collections skip clean parts of a region
+constexpr size_t kCardChunkShift = 12;
+constexpr size_t kCardChunks = kCardsPerRegion >> kCardChunkShift;
+
+// Byte per 512-byte card over every range the collector allocates from. Regions of 1 GiB get
+// their card bytes on first use, so dirtying a card is two loads and a store without any lock.
+class CardTable {
+public:
+    CardTable();
+    CardTable(const CardTable&) = delete;
+    CardTable& operator=(const CardTable&) = delete;
+    ~CardTable();
+
+    // makes cards for the range available, thread-safe
+    void Cover(uintptr_t start, size_t size);
+
+    void Dirty(uintptr_t addr) {
+        size_t region = addr >> kCardRegionShift;
+        if (region >= kCardRegions) {
+            return;
+        }
+        Region* cards = regions_[region].load(std::memory_order_acquire);
+        if (cards == nullptr) {
+            return;
+        }
+        size_t card = (addr >> kCardShift) & (kCardsPerRegion - 1);
+        std::atomic_ref<uint8_t>(cards->cards[card]).store(1, std::memory_order_relaxed);
+        std::atomic_ref<uint8_t>(cards->chunks[card >> kCardChunkShift])
+            .store(1, std::memory_order_relaxed);
+    }
+
+    // calls visitor(card_start) for every dirty card, the world must be stopped
+    template <typename Visitor>
+    void ForEachDirty(Visitor&& visitor) const {
+        for (size_t region : covered_) {
+            const Region* cards = regions_[region].load(std::memory_order_relaxed);
+            for (size_t chunk = 0; chunk < kCardChunks; ++chunk) {
+                if (!cards->chunks[chunk]) {
+                    continue;
+                }
+                size_t first = chunk << kCardChunkShift;
+                for (size_t card = first; card < first + (size_t{1} << kCardChunkShift); ++card) {
+                    if (cards->cards[card]) {
+                        visitor((region << kCardRegionShift) | (card << kCardShift));
+                    }
+                }
+            }
+        }
+    }
+
+    // the world must be stopped
+    void Clear();
+
+private:
+    struct Region {
+        uint8_t cards[kCardsPerRegion];
+        uint8_t chunks[kCardChunks];
+    };
+
+    std::unique_ptr<std::atomic<Region*>[]> regions_;
+    std::mutex covering_;
+    std::vector<size_t> covered_;
+};
@@ -0,0 +1,184 @@
+#include "gc_dirty_pages.h"
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+// older headers lack the flags of asynchronous write protection (Linux 6.7)
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+
+constexpr uint64_t kUffdFeatures =
+    UFFD_FEATURE_PAGEFAULT_FLAG_WP | UFFD_FEATURE_WP_UNPOPULATED | UFFD_FEATURE_WP_ASYNC;
+#endif
+
+constexpr int kPagemapSoftDirtyBit = 55;
+constexpr int kPagemapUffdWpBit = 57;
+
+DirtyPageTracker::~DirtyPageTracker() {
+    Close();
+}
+
+bool DirtyPageTracker::Enable() {
+    if (mechanism_ != DirtyTracking::kNone) {
+        return true;
+    }
+#ifdef __linux__
+    page_size_ = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    pagemap_fd_ = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (pagemap_fd_ >= 0 && (EnableSoftDirty() || EnableUserfaultfd())) {
+        return true;
+    }
+    Close();
+#endif
+    return false;
+}
+
+bool DirtyPageTracker::EnableSoftDirty() {
+#ifdef __linux__
+    clear_refs_fd_ = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (clear_refs_fd_ < 0) {
+        return false;
+    }
+    mechanism_ = DirtyTracking::kSoftDirty;
+    // the file is there even if the kernel is built without soft-dirty bits, they never get set
+    if (Probe()) {
+        return true;
+    }
+    mechanism_ = DirtyTracking::kNone;
+    close(clear_refs_fd_);
+    clear_refs_fd_ = -1;
+#endif
+    return false;
+}
+
+bool DirtyPageTracker::EnableUserfaultfd() {
+#ifdef __linux__
+    uffd_ = static_cast<int>(syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+    if (uffd_ < 0) {
+        // kernels before 5.11 don't know the flag
+        uffd_ = static_cast<int>(syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+    }
+    if (uffd_ < 0) {
+        return false;
+    }
+    // faults on protected pages are resolved by the kernel, nobody reads the descriptor
+    uffdio_api api = {};
+    api.api = UFFD_API;
+    api.features = kUffdFeatures;
+    if (ioctl(uffd_, UFFDIO_API, &api) == 0 && (api.features & kUffdFeatures) == kUffdFeatures) {
+        mechanism_ = DirtyTracking::kUserfaultfd;
+        if (Probe()) {
+            return true;
+        }
+        mechanism_ = DirtyTracking::kNone;
+    }
+    close(uffd_);
+    uffd_ = -1;
+#endif
+    return false;
+}
+
+// writes to a scratch page around a Clear and checks that only the second write is seen
+bool DirtyPageTracker::Probe() {
+#ifdef __linux__
+    void* mem = mmap(nullptr, page_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    auto page = reinterpret_cast<uintptr_t>(mem);
+    volatile char* byte = static_cast<volatile char*>(mem);
+    bool clean = true, dirty = false;
+    *byte = 1;
+    Clear();
+    Protect(page, page_size_);
+    ForEachDirty(page, page_size_, [&](uintptr_t, uintptr_t) { clean = false; });
+    *byte = 2;
+    ForEachDirty(page, page_size_, [&](uintptr_t, uintptr_t) { dirty = true; });
+    munmap(mem, page_size_);
+    return clean && dirty;
+#else
+    return false;
+#endif
+}
+
+void DirtyPageTracker::Close() {
+#ifdef __linux__
+    // closing the userfaultfd unregisters its ranges and drops their protection
+    for (int* fd : {&pagemap_fd_, &clear_refs_fd_, &uffd_}) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+#endif
+    mechanism_ = DirtyTracking::kNone;
+}
+
+void DirtyPageTracker::Clear() {
+#ifdef __linux__
+    if (mechanism_ == DirtyTracking::kSoftDirty) {
+        // "4" resets the soft-dirty bits of every page of the process
+        [[maybe_unused]] ssize_t written = write(clear_refs_fd_, "4", 1);
+    }
+#endif
+}
+
+void DirtyPageTracker::Protect(uintptr_t start, size_t size) {
+#ifdef __linux__
+    if (mechanism_ != DirtyTracking::kUserfaultfd || size == 0) {
+        return;
+    }
+    uintptr_t first = start & ~(page_size_ - 1);
+    uintptr_t last = (start + size + page_size_ - 1) & ~(page_size_ - 1);
+    // registering a range again with the same descriptor is allowed
+    uffdio_register reg = {};
+    reg.range.start = first;
+    reg.range.len = last - first;
+    reg.mode = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(uffd_, UFFDIO_REGISTER, &reg) != 0) {
+        return;
+    }
+    uffdio_writeprotect protect = {};
+    protect.range = reg.range;
+    protect.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+    ioctl(uffd_, UFFDIO_WRITEPROTECT, &protect);
+#else
+    (void)start;
+    (void)size;
+#endif
+}
+
+bool DirtyPageTracker::ReadEntries(uintptr_t page, size_t count, uint64_t* entries) const {
+#ifdef __linux__
+    size_t bytes = count * sizeof(uint64_t);
+    off_t offset = static_cast<off_t>(page / page_size_ * sizeof(uint64_t));
+    return pread(pagemap_fd_, entries, bytes, offset) == static_cast<ssize_t>(bytes);
+#else
+    (void)page;
+    (void)count;
+    (void)entries;
+    return false;
+#endif
+}
+
+bool DirtyPageTracker::IsDirty(uint64_t entry) const {
+    if (mechanism_ == DirtyTracking::kSoftDirty) {
+        return (entry >> kPagemapSoftDirtyBit) & 1;
+    }
+    // the kernel lifts the protection of a page on its first write
+    return !((entry >> kPagemapUffdWpBit) & 1);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+constexpr size_t kPagemapBatch = 4096;  // pagemap entries read at once
+
+// How DirtyPageTracker learns about writes
+enum class DirtyTracking {
+    kNone,
+    kSoftDirty,    // soft-dirty bits of the page tables, reset through /proc/self/clear_refs
+    kUserfaultfd,  // asynchronous userfaultfd write protection, lifted by the kernel on a write
+};
+
+// Finds the pages written since the last Clear, the virtual dirty bits of Boehm's mostly parallel
+// collector. Both mechanisms are read through /proc/self/pagemap. Soft-dirty bits cover the whole
+// process, write protection only the ranges passed to Protect, so other memory reads as dirty.
+// Linux only, Enable fails elsewhere. Not thread-safe, callers serialize access.
+class DirtyPageTracker {
+public:
+    DirtyPageTracker() = default;
+    DirtyPageTracker(const DirtyPageTracker&) = delete;
+    DirtyPageTracker& operator=(const DirtyPageTracker&) = delete;
+    ~DirtyPageTracker();
+
+    // picks the first mechanism the kernel supports, false if there is none
+    bool Enable();
+    DirtyTracking Mechanism() const {
+        return mechanism_;
+    }
+    // whether only the ranges passed to Protect are tracked
+    bool ProtectsRanges() const {
+        return mechanism_ == DirtyTracking::kUserfaultfd;
+    }
+
+    // starts a new interval, ranges to track follow through Protect
+    void Clear();
+    // a range that fails to register stays unprotected and reads as dirty
+    void Protect(uintptr_t start, size_t size);
+
+    // calls visit(start, end) for every run of pages in [start, start + size) written since
+    // Clear, clamped to the range. Pages whose state can't be read count as written
+    template <typename Visitor>
+    void ForEachDirty(uintptr_t start, size_t size, Visitor visit);
+
+private:
+    bool EnableSoftDirty();
+    bool EnableUserfaultfd();
+    bool Probe();
+    void Close();
+    bool ReadEntries(uintptr_t page, size_t count, uint64_t* entries) const;
+    bool IsDirty(uint64_t entry) const;
+
+    DirtyTracking mechanism_ = DirtyTracking::kNone;
+    size_t page_size_ = 4096;
+    int pagemap_fd_ = -1;
+    int clear_refs_fd_ = -1;
+    int uffd_ = -1;
+};
+
+template <typename Visitor>
+void DirtyPageTracker::ForEachDirty(uintptr_t start, size_t size, Visitor visit) {
+    uintptr_t end = start + size;
+    uintptr_t page = start & ~(page_size_ - 1);
+    uintptr_t run_start = 0;
+    bool in_run = false;
+    uint64_t entries[kPagemapBatch];
+    while (page < end) {
+        size_t count = std::min(kPagemapBatch, (end - page + page_size_ - 1) / page_size_);
+        bool read = ReadEntries(page, count, entries);
+        for (size_t i = 0; i < count; ++i, page += page_size_) {
+            bool dirty = !read || IsDirty(entries[i]);
+            if (dirty && !in_run) {
+                run_start = std::max(page, start);
+                in_run = true;
+            } else if (!dirty && in_run) {
+                visit(run_start, page);
+                in_run = false;
+            }
+        }
+    }
+    if (in_run) {
+        visit(run_start, end);
+    }
+}
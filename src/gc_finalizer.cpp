@@ -0,0 +1,116 @@
+#include "gc_finalizer.h"
+#include <algorithm>
+#include <utility>
+
+FinalizerExecutor::FinalizerExecutor(ReleaseFn release) : release_(std::move(release)) {
+}
+
+FinalizerExecutor::~FinalizerExecutor() {
+    Stop();
+}
+
+void FinalizerExecutor::Push(std::vector<PendingFinalizer>* finalizable) {
+    if (finalizable->empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        queue_.insert(queue_.end(), finalizable->begin(), finalizable->end());
+        if (!thread_.joinable() && !stop_) {
+            thread_ = std::thread(&FinalizerExecutor::ExecutorLoop, this);
+        }
+    }
+    finalizable->clear();
+    wake_.notify_one();
+}
+
+size_t FinalizerExecutor::RunPending() {
+    size_t done = 0;
+    while (true) {
+        size_t ran;
+        while ((ran = RunBatch()) != 0) {
+            done += ran;
+        }
+        // objects of a batch the executor is running are not freed yet, and what it didn't get
+        // to within its batch time goes back to the queue
+        std::unique_lock<std::mutex> lock(lock_);
+        idle_.wait(lock, [this] { return running_batches_ == 0; });
+        if (queue_.empty()) {
+            return done;
+        }
+    }
+}
+
+size_t FinalizerExecutor::NumPending() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return queue_.size();
+}
+
+void FinalizerExecutor::SetBatchTime(std::chrono::nanoseconds time) {
+    batch_time_ns_ = time.count();
+}
+
+std::chrono::nanoseconds FinalizerExecutor::GetBatchTime() const {
+    return std::chrono::nanoseconds(batch_time_ns_.load());
+}
+
+void FinalizerExecutor::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void FinalizerExecutor::ExecutorLoop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            wake_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (stop_) {
+                return;
+            }
+        }
+        RunBatch();
+        // let mutators have the collector lock between batches
+        std::this_thread::yield();
+    }
+}
+
+// returns the number of finalizers run, 0 once the queue is empty
+size_t FinalizerExecutor::RunBatch() {
+    std::vector<PendingFinalizer> batch;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        size_t count = std::min(queue_.size(), kFinalizerBatchSize);
+        if (count == 0) {
+            return 0;
+        }
+        batch.assign(queue_.begin(), queue_.begin() + count);
+        queue_.erase(queue_.begin(), queue_.begin() + count);
+        ++running_batches_;
+    }
+    auto deadline = std::chrono::steady_clock::now() + GetBatchTime();
+    size_t done = 0;
+    // at least one finalizer runs, so a batch always makes progress
+    while (done < batch.size()) {
+        const PendingFinalizer& object = batch[done++];
+        object.finalizer(reinterpret_cast<void*>(object.ptr), object.size);
+        if (std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+    }
+    std::vector<PendingFinalizer> rest(batch.begin() + done, batch.end());
+    batch.resize(done);
+    release_(batch);
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        queue_.insert(queue_.begin(), rest.begin(), rest.end());
+        --running_batches_;
+    }
+    idle_.notify_all();
+    return done;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "gc_heap.h"
+
+constexpr size_t kFinalizerBatchSize = 256;
+constexpr std::chrono::nanoseconds kDefaultFinalizerBatchTime = std::chrono::milliseconds(1);
+
+// Runs the finalizers of dead objects outside of collections. A sweep queues the objects, a
+// lazily started executor thread takes them in batches and runs their finalizers without any
+// collector lock. Once a batch is done, release frees the memory of its objects. A batch stops
+// early when it has run for longer than the batch time, the rest goes back to the queue.
+class FinalizerExecutor {
+public:
+    using ReleaseFn = std::function<void(const std::vector<PendingFinalizer>&)>;
+
+    explicit FinalizerExecutor(ReleaseFn release);
+    FinalizerExecutor(const FinalizerExecutor&) = delete;
+    FinalizerExecutor& operator=(const FinalizerExecutor&) = delete;
+    ~FinalizerExecutor();
+
+    // takes the objects out of finalizable and wakes the executor
+    void Push(std::vector<PendingFinalizer>* finalizable);
+    // runs everything queued on the calling thread and waits for the executor's batch,
+    // returns the number of finalizers run by this call
+    size_t RunPending();
+    size_t NumPending();
+
+    void SetBatchTime(std::chrono::nanoseconds time);
+    std::chrono::nanoseconds GetBatchTime() const;
+
+    // joins the executor, queued objects stay for RunPending
+    void Stop();
+
+private:
+    void ExecutorLoop();
+    size_t RunBatch();
+
+    ReleaseFn release_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::deque<PendingFinalizer> queue_;
+    size_t running_batches_ = 0;
+    bool stop_ = false;
+    std::thread thread_;
+    std::atomic<int64_t> batch_time_ns_ = kDefaultFinalizerBatchTime.count();
+};
@@ -0,0 +1,324 @@
+#include "gc_heap.h"
+#include <sys/mman.h>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+static constexpr std::array<uint8_t, kMaxSmallSize / kMinObjectSize + 1> BuildClassLookup() {
+    std::array<uint8_t, kMaxSmallSize / kMinObjectSize + 1> lookup{};
+    size_t size_class = 0;
+    for (size_t i = 0; i < lookup.size(); ++i) {
+        while (kSizeClasses[size_class] < i * kMinObjectSize) {
+            ++size_class;
+        }
+        lookup[i] = static_cast<uint8_t>(size_class);
+    }
+    return lookup;
+}
+
+static constexpr auto kClassLookup = BuildClassLookup();
+
+size_t SizeClassOf(size_t size) {
+    return kClassLookup[(size + kMinObjectSize - 1) / kMinObjectSize];
+}
+
+static uint64_t ValidSlotsMask(const PageHeader& page, size_t word) {
+    size_t first = word * 64;
+    if (first >= page.num_objects) {
+        return 0;
+    }
+    size_t count = page.num_objects - first;
+    return count >= 64 ? ~uint64_t{0} : (uint64_t{1} << count) - 1;
+}
+
+PageKind KindOf(FinalizerT finalizer, const GCLayout* layout) {
+    int kind = IsFinalizable(finalizer) ? kFinalizablePage : kNormalPage;
+    if (layout != nullptr) {
+        kind += layout->IsPointerFree() ? kPointerFreePage : kTypedPage;
+    }
+    return static_cast<PageKind>(kind);
+}
+
+// only the owner of the page sets bits, so a free bit seen here stays free
+static size_t TakeFreeSlot(PageHeader* page) {
+    for (size_t word = 0; word < kBitmapWords; ++word) {
+        std::atomic_ref<uint64_t> bits(page->alloc_bits[word]);
+        uint64_t free_bits = ~bits.load(std::memory_order_relaxed) & ValidSlotsMask(*page, word);
+        if (free_bits != 0) {
+            size_t bit = std::countr_zero(free_bits);
+            bits.fetch_or(uint64_t{1} << bit, std::memory_order_relaxed);
+            std::atomic_ref<uint16_t>(page->free_objects).fetch_sub(1, std::memory_order_relaxed);
+            return word * 64 + bit;
+        }
+    }
+    return kInvalidSlot;
+}
+
+SmallObjectHeap::SmallObjectHeap(PageMap* page_map) : page_map_(page_map) {
+}
+
+SmallObjectHeap::~SmallObjectHeap() {
+    ReleaseAll();
+}
+
+void* SmallObjectHeap::Allocate(size_t size, FinalizerT finalizer, const GCLayout* layout) {
+    PageKind kind = KindOf(finalizer, layout);
+    size_t size_class = SizeClassOf(size);
+    SizeClassState& state = classes_[kind][size_class];
+    if (state.current != nullptr) {
+        if (void* ptr = AllocateInPage(state.current, size, finalizer, layout)) {
+            return ptr;
+        }
+        state.current->owned = false;
+        state.current = nullptr;
+    }
+    state.current = NextPage(kind, size_class);
+    if (state.current == nullptr) {
+        return nullptr;
+    }
+    state.current->owned = true;
+    return AllocateInPage(state.current, size, finalizer, layout);
+}
+
+void* SmallObjectHeap::AllocateInPage(PageHeader* page, size_t size, FinalizerT finalizer,
+                                      const GCLayout* layout) {
+    size_t slot = TakeFreeSlot(page);
+    if (slot == kInvalidSlot) {
+        return nullptr;
+    }
+    if (page->finalizers) {
+        page->finalizers[slot] = finalizer;
+    }
+    if (page->layouts) {
+        page->layouts[slot] = layout;
+    }
+    uintptr_t obj = page->ObjectStart(slot);
+    // slack after the requested size is scanned, so don't leave stale pointers
+    if (size < page->object_size && page->GetLayout(slot) != &kPointerFreeLayout) {
+        std::memset(reinterpret_cast<void*>(obj + size), 0, page->object_size - size);
+    }
+    return reinterpret_cast<void*>(obj);
+}
+
+PageHeader* SmallObjectHeap::AcquirePage(size_t size, FinalizerT finalizer,
+                                         const GCLayout* layout) {
+    PageHeader* page = NextPage(KindOf(finalizer, layout), SizeClassOf(size));
+    if (page != nullptr) {
+        page->owned = true;
+    }
+    return page;
+}
+
+void SmallObjectHeap::ReturnPage(PageHeader* page) {
+    page->owned = false;
+    if (page->free_objects > 0) {
+        classes_[page->kind][page->size_class].partial.push_back(page);
+    }
+}
+
+void SmallObjectHeap::Release(PageHeader* page, size_t slot) {
+    std::atomic_ref<uint64_t>(page->alloc_bits[slot / 64])
+        .fetch_and(~(uint64_t{1} << (slot % 64)), std::memory_order_relaxed);
+    // a sticky mark would make the next object in the slot old
+    // a concurrent mark may set other bits of the word
+    std::atomic_ref<uint64_t>(page->mark_bits[slot / 64])
+        .fetch_and(~(uint64_t{1} << (slot % 64)), std::memory_order_relaxed);
+    page->finalizing_bits[slot / 64] &= ~(uint64_t{1} << (slot % 64));
+    uint16_t was_free =
+        std::atomic_ref<uint16_t>(page->free_objects).fetch_add(1, std::memory_order_relaxed);
+    // the sweeper lists unswept pages once it is done with them
+    if (was_free == 0 && !page->owned && IsSwept(page)) {
+        classes_[page->kind][page->size_class].partial.push_back(page);
+    }
+}
+
+void SmallObjectHeap::ReleaseAll() {
+    for (const auto& arena : arenas_) {
+        page_map_->Clear(arena->start, kArenaSize);
+        munmap(reinterpret_cast<void*>(arena->start), kArenaSize);
+    }
+    arenas_.clear();
+    bump_arena_ = nullptr;
+    free_pages_.clear();
+    sweep_chunks_.clear();
+    for (auto& kind_classes : classes_) {
+        for (SizeClassState& state : kind_classes) {
+            state.current = nullptr;
+            state.partial.clear();
+        }
+    }
+}
+
+PageHeader* SmallObjectHeap::NextPage(PageKind kind, size_t size_class) {
+    SizeClassState& state = classes_[kind][size_class];
+    if (!state.partial.empty()) {
+        PageHeader* page = state.partial.back();
+        state.partial.pop_back();
+        return page;
+    }
+    PageHeader* page = NewPage();
+    if (page == nullptr) {
+        return nullptr;
+    }
+    InitPage(page, kind, size_class);
+    return page;
+}
+
+PageHeader* SmallObjectHeap::NewPage() {
+    if (!free_pages_.empty()) {
+        PageHeader* page = free_pages_.back();
+        free_pages_.pop_back();
+        return page;
+    }
+    if (bump_arena_ == nullptr || bump_arena_->used_pages == kPagesPerArena) {
+        if (!AddArena()) {
+            return nullptr;
+        }
+    }
+    PageHeader* page = &bump_arena_->pages[bump_arena_->used_pages];
+    ++bump_arena_->used_pages;
+    return page;
+}
+
+void SmallObjectHeap::InitPage(PageHeader* page, PageKind kind, size_t size_class) {
+    page->kind = kind;
+    page->size_class = static_cast<uint8_t>(size_class);
+    page->object_size = static_cast<uint32_t>(kSizeClasses[size_class]);
+    page->num_objects = static_cast<uint16_t>(kPageSize / page->object_size);
+    page->free_objects = page->num_objects;
+    page->swept_epoch = sweep_epoch_;
+    std::fill(std::begin(page->alloc_bits), std::end(page->alloc_bits), 0);
+    std::fill(std::begin(page->mark_bits), std::end(page->mark_bits), 0);
+    std::fill(std::begin(page->finalizing_bits), std::end(page->finalizing_bits), 0);
+    if (HasFinalizers(kind)) {
+        page->finalizers = std::make_unique<FinalizerT[]>(page->num_objects);
+    }
+    if (kind == kTypedPage || kind == kTypedFinalizablePage) {
+        page->layouts = std::make_unique<const GCLayout*[]>(page->num_objects);
+    }
+}
+
+void SmallObjectHeap::FreePage(PageHeader* page) {
+    page->kind = kFreePage;
+    page->finalizers.reset();
+    page->layouts.reset();
+    free_pages_.push_back(page);
+}
+
+bool SmallObjectHeap::AddArena() {
+    void* mem = mmap(nullptr, kArenaSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    auto arena = std::make_unique<Arena>();
+    arena->start = reinterpret_cast<uintptr_t>(mem);
+    arena->used_pages = 0;
+    arena->pages = std::make_unique<PageHeader[]>(kPagesPerArena);
+    // pages not carved yet are kFreePage, so lookups skip them
+    for (size_t i = 0; i < kPagesPerArena; ++i) {
+        PageHeader* page = &arena->pages[i];
+        page->start = arena->start + i * kPageSize;
+        page_map_->Set(page->start, kPageSize, PageMapEntry::SmallPage(page));
+    }
+    bump_arena_ = arena.get();
+    arenas_.push_back(std::move(arena));
+    return true;
+}
+
+void SmallObjectHeap::ClearMarks() {
+    for (const auto& arena : arenas_) {
+        for (size_t i = 0; i < arena->used_pages; ++i) {
+            PageHeader& page = arena->pages[i];
+            std::fill(std::begin(page.mark_bits), std::end(page.mark_bits), 0);
+        }
+    }
+}
+
+size_t SmallObjectHeap::PrepareSweep() {
+    for (auto& kind_classes : classes_) {
+        for (SizeClassState& state : kind_classes) {
+            if (state.current != nullptr) {
+                state.current->owned = false;
+                state.current = nullptr;
+            }
+            state.partial.clear();
+        }
+    }
+    ++sweep_epoch_;
+    sweep_chunks_.clear();
+    for (const auto& arena : arenas_) {
+        for (size_t i = 0; i < arena->used_pages; i += kSweepChunkPages) {
+            sweep_chunks_.push_back(
+                PageRange{&arena->pages[i], std::min(kSweepChunkPages, arena->used_pages - i)});
+        }
+    }
+    return sweep_chunks_.size();
+}
+
+// only touches the pages of the chunk unless relist is set
+size_t SmallObjectHeap::SweepChunk(size_t index, bool relist,
+                                   std::vector<PendingFinalizer>* deferred) {
+    size_t freed_bytes = 0;
+    const PageRange& chunk = sweep_chunks_[index];
+    for (size_t i = 0; i < chunk.count; ++i) {
+        PageHeader& page = chunk.first[i];
+        if (page.kind == kFreePage || IsSwept(&page)) {
+            continue;
+        }
+        size_t live = 0;
+        for (size_t word = 0; word < kBitmapWords; ++word) {
+            uint64_t dead =
+                page.alloc_bits[word] & ~page.mark_bits[word] & ~page.finalizing_bits[word];
+            if (page.finalizers && deferred != nullptr) {
+                for (uint64_t bits = dead; bits != 0; bits &= bits - 1) {
+                    size_t slot = word * 64 + std::countr_zero(bits);
+                    deferred->push_back(PendingFinalizer{page.ObjectStart(slot), page.object_size,
+                                                         page.finalizers[slot]});
+                }
+                page.finalizing_bits[word] |= dead;
+                live += std::popcount(page.alloc_bits[word]);
+                continue;
+            }
+            if (page.finalizers) {
+                for (uint64_t bits = dead; bits != 0; bits &= bits - 1) {
+                    size_t slot = word * 64 + std::countr_zero(bits);
+                    page.finalizers[slot](reinterpret_cast<void*>(page.ObjectStart(slot)),
+                                          page.object_size);
+                }
+            }
+            freed_bytes += std::popcount(dead) * page.object_size;
+            page.alloc_bits[word] &= page.mark_bits[word] | page.finalizing_bits[word];
+            live += std::popcount(page.alloc_bits[word]);
+        }
+        page.free_objects = static_cast<uint16_t>(page.num_objects - live);
+        page.swept_epoch = sweep_epoch_;
+        if (relist) {
+            RelistPage(&page);
+        }
+    }
+    return freed_bytes;
+}
+
+void SmallObjectHeap::FinishSweep() {
+    for (const PageRange& chunk : sweep_chunks_) {
+        for (size_t i = 0; i < chunk.count; ++i) {
+            if (chunk.first[i].kind != kFreePage) {
+                RelistPage(&chunk.first[i]);
+            }
+        }
+    }
+    sweep_chunks_.clear();
+}
+
+void SmallObjectHeap::RelistPage(PageHeader* page) {
+    if (page->owned) {
+        return;
+    }
+    if (page->free_objects == page->num_objects) {
+        FreePage(page);
+    } else if (page->free_objects > 0) {
+        classes_[page->kind][page->size_class].partial.push_back(page);
+    }
+}
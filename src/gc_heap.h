@@ -0,0 +1,231 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "gc.h"
+#include "gc_layout.h"
+#include "gc_page_map.h"
+
+constexpr size_t kPageShift = 12;
+constexpr size_t kPageSize = size_t{1} << kPageShift;
+constexpr size_t kArenaSize = 16 * 1024 * 1024;
+constexpr size_t kPagesPerArena = kArenaSize / kPageSize;
+constexpr size_t kSweepChunkPages = 64;  // pages a sweep worker takes at once
+
+constexpr size_t kMinObjectSize = 16;
+constexpr size_t kMaxSmallSize = 2048;
+constexpr size_t kMaxObjectsPerPage = kPageSize / kMinObjectSize;
+constexpr size_t kBitmapWords = kMaxObjectsPerPage / 64;
+constexpr size_t kInvalidSlot = static_cast<size_t>(-1);
+
+constexpr size_t kSizeClasses[] = {16,  32,  48,  64,  80,  96,  112, 128,  160,  192, 224,
+                                   256, 320, 384, 448, 512, 640, 768, 1024, 1360, 2048};
+constexpr size_t kNumSizeClasses = sizeof(kSizeClasses) / sizeof(kSizeClasses[0]);
+
+// Objects on one page share a kind, so per-object metadata is only kept where it is needed.
+// The low bit says whether objects have custom finalizers, stored in a side array, the rest how
+// objects are scanned
+enum PageKind : uint8_t {
+    kNormalPage,                   // objects with BasicFinalizer, no per-object metadata
+    kFinalizablePage,              // objects with a custom finalizer
+    kPointerFreePage,              // objects that are never scanned
+    kPointerFreeFinalizablePage,
+    kTypedPage,                    // objects scanned by their layout, stored in a side array
+    kTypedFinalizablePage,
+    kNumPageKinds,
+    kFreePage = kNumPageKinds,
+};
+
+inline bool HasFinalizers(PageKind kind) {
+    return kind & 1;
+}
+
+// finalizers other than BasicFinalizer have to run before the memory of an object is reused
+inline bool IsFinalizable(FinalizerT finalizer) {
+    return finalizer != nullptr && finalizer != BasicFinalizer;
+}
+
+// dead object whose finalizer has not run yet, its memory is kept until then
+struct PendingFinalizer {
+    uintptr_t ptr;
+    size_t size;
+    FinalizerT finalizer;
+};
+
+inline bool IsSmallSize(size_t size) {
+    return size <= kMaxSmallSize;
+}
+
+size_t SizeClassOf(size_t size);
+// kind of the pages an object goes to, a layout of nullptr is scanned conservatively
+PageKind KindOf(FinalizerT finalizer, const GCLayout* layout);
+
+// Header of a page carved into equal slots of one size class. Headers live out of line in the
+// arena, so the page itself is fully usable and the mark phase touches only compact metadata.
+struct PageHeader {
+    uintptr_t start = 0;
+    uint32_t object_size = 0;
+    uint16_t num_objects = 0;
+    uint16_t free_objects = 0;
+    uint8_t size_class = 0;
+    PageKind kind = kFreePage;
+    bool owned = false;  // some allocator takes free slots from this page, it's not in partial list
+    uint64_t swept_epoch = 0;  // last sweep that covered the page, see SmallObjectHeap::IsSwept
+    uint64_t alloc_bits[kBitmapWords] = {};
+    uint64_t mark_bits[kBitmapWords] = {};
+    uint64_t finalizing_bits[kBitmapWords] = {};  // dead but allocated until finalized
+    std::unique_ptr<FinalizerT[]> finalizers;
+    std::unique_ptr<const GCLayout*[]> layouts;
+
+    // slot of allocated object containing ptr, kInvalidSlot otherwise
+    size_t SlotOf(uintptr_t ptr) const {
+        size_t slot = (ptr - start) / object_size;
+        if (slot >= num_objects || !IsAllocated(slot)) {
+            return kInvalidSlot;
+        }
+        return slot;
+    }
+
+    uintptr_t ObjectStart(size_t slot) const {
+        return start + slot * object_size;
+    }
+
+    // the owner of the page sets alloc bits while other threads may free slots, so the
+    // bitmap and the free counter are updated atomically
+    bool IsAllocated(size_t slot) const {
+        uint64_t word = std::atomic_ref<const uint64_t>(alloc_bits[slot / 64]).load(
+            std::memory_order_relaxed);
+        return (word >> (slot % 64)) & 1;
+    }
+
+    bool IsMarked(size_t slot) const {
+        return (mark_bits[slot / 64] >> (slot % 64)) & 1;
+    }
+
+    // returns true if the object was not marked before
+    bool TestAndMark(size_t slot) {
+        uint64_t bit = uint64_t{1} << (slot % 64);
+        std::atomic_ref<uint64_t> word(mark_bits[slot / 64]);
+        if (word.load(std::memory_order_relaxed) & bit) {
+            return false;
+        }
+        return !(word.fetch_or(bit, std::memory_order_relaxed) & bit);
+    }
+
+    // a finalizing object is dead but left alone by sweeps until Release
+    bool IsFinalizing(size_t slot) const {
+        return (finalizing_bits[slot / 64] >> (slot % 64)) & 1;
+    }
+
+    void SetFinalizing(size_t slot) {
+        finalizing_bits[slot / 64] |= uint64_t{1} << (slot % 64);
+    }
+
+    FinalizerT GetFinalizer(size_t slot) const {
+        return finalizers ? finalizers[slot] : BasicFinalizer;
+    }
+
+    // how the object is scanned, nullptr is conservatively
+    const GCLayout* GetLayout(size_t slot) const {
+        if (layouts) {
+            return layouts[slot];
+        }
+        return kind == kPointerFreePage || kind == kPointerFreeFinalizablePage
+                   ? &kPointerFreeLayout
+                   : nullptr;
+    }
+};
+
+struct Arena {
+    uintptr_t start;
+    size_t used_pages;
+    std::unique_ptr<PageHeader[]> pages;
+};
+
+// Segregated heap for small objects: mmap'd arenas split into pages of fixed size classes.
+// Object membership and size come from the page header, not from a sorted allocation table.
+// Not thread-safe, callers serialize access.
+class SmallObjectHeap {
+public:
+    // pages of new arenas are registered in page_map
+    explicit SmallObjectHeap(PageMap* page_map);
+    SmallObjectHeap(const SmallObjectHeap&) = delete;
+    SmallObjectHeap& operator=(const SmallObjectHeap&) = delete;
+    ~SmallObjectHeap();
+
+    // nullptr when the OS refuses to map a new arena. Objects with a layout are scanned by it
+    void* Allocate(size_t size, FinalizerT finalizer, const GCLayout* layout = nullptr);
+    // nullptr when the page is full, needs no heap lock if the caller owns the page
+    static void* AllocateInPage(PageHeader* page, size_t size, FinalizerT finalizer,
+                                const GCLayout* layout = nullptr);
+    // hands out a page with free slots for exclusive use until ReturnPage
+    PageHeader* AcquirePage(size_t size, FinalizerT finalizer, const GCLayout* layout = nullptr);
+    void ReturnPage(PageHeader* page);
+    // returns slot to the page without calling the finalizer, also after a deferred finalizer
+    void Release(PageHeader* page, size_t slot);
+    void ReleaseAll();
+
+    PageHeader* FindPage(uintptr_t ptr) const {
+        return FindPage(page_map_->Get(ptr));
+    }
+
+    static PageHeader* FindPage(PageMapEntry entry) {
+        PageHeader* page = entry.AsSmallPage();
+        return page != nullptr && page->kind != kFreePage ? page : nullptr;
+    }
+
+    void ClearMarks();
+    // calls visit(start, size) for the pages of every arena that were ever handed out
+    template <typename Visitor>
+    void ForEachArena(Visitor visit) const {
+        for (const auto& arena : arenas_) {
+            visit(arena->start, arena->used_pages * kPageSize);
+        }
+    }
+
+    // Sweep in three steps, so that the chunks can be swept by several threads. PrepareSweep
+    // returns the number of chunks, SweepChunk may run concurrently for different chunks and
+    // FinishSweep puts the swept pages back on the free and partial lists.
+    // Pages allocated from after PrepareSweep are never swept, so the heap can be used while the
+    // chunks are swept if every call is serialized with SweepChunk. relist puts the swept pages
+    // back on the lists right away then, instead of FinishSweep.
+    // With deferred set, dead objects with finalizers stay allocated and are appended to it,
+    // they are not swept again and their slots are freed by Release once finalized.
+    size_t PrepareSweep();
+    size_t SweepChunk(size_t index, bool relist = false,
+                      std::vector<PendingFinalizer>* deferred = nullptr);
+    void FinishSweep();
+
+    // unswept pages are left off the page lists, their dead slots are still taken
+    bool IsSwept(const PageHeader* page) const {
+        return page->swept_epoch == sweep_epoch_;
+    }
+
+private:
+    struct SizeClassState {
+        PageHeader* current = nullptr;
+        std::vector<PageHeader*> partial;
+    };
+    struct PageRange {
+        PageHeader* first;
+        size_t count;
+    };
+
+    PageHeader* NextPage(PageKind kind, size_t size_class);
+    PageHeader* NewPage();
+    void InitPage(PageHeader* page, PageKind kind, size_t size_class);
+    void FreePage(PageHeader* page);
+    void RelistPage(PageHeader* page);
+    bool AddArena();
+
+    PageMap* page_map_;
+    std::vector<std::unique_ptr<Arena>> arenas_;
+    Arena* bump_arena_ = nullptr;  // arena new pages are carved from
+    std::vector<PageHeader*> free_pages_;
+    SizeClassState classes_[kNumPageKinds][kNumSizeClasses];
+    std::vector<PageRange> sweep_chunks_;
+    uint64_t sweep_epoch_ = 0;
+};
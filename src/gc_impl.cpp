@@ -1,10 +1,11 @@
 #include "gc_impl.h"
 #include "gc.h"
 #include "gc_fwd.h"
-#include "stealing_queue.h"
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -13,86 +14,345 @@ uintptr_t Aligned(uintptr_t ptr) {
     return ptr + (kAlignment - ptr % kAlignment) % kAlignment;
 }
 
-static uintptr_t GetMemoryPtr(uintptr_t ptr) {
-    void** mem_ptr = reinterpret_cast<void**>(ptr);
-    return (mem_ptr == nullptr ? 0 : reinterpret_cast<uintptr_t>(*mem_ptr));
-}
+static thread_local ThreadCache* current_cache = nullptr;
 
-GCImpl::GCImpl() : timer_(0), scheduler_(this) {
+GCImpl::GCImpl()
+    : small_heap_(&page_map_),
+      large_space_(&page_map_),
+      finalizers_([this](const std::vector<PendingFinalizer>& objects) {
+          std::lock_guard<std::mutex> lock(lock_collect_);
+          ReleaseFinalized(objects);
+      }),
+      scheduler_(this),
+      poll_page_([](void* gc) { static_cast<GCImpl*>(gc)->Park(); }, this) {
+    mark_workers_.push_back(std::make_unique<MarkWorker>());
 }
 
 void GCImpl::FreeAll() {
+    {
+        std::lock_guard<std::mutex> lock(lock_collect_);
+        FinishSweep();
+    }
+    // queued finalizers still use their objects
+    finalizers_.RunPending();
     std::lock_guard<std::mutex> lock(lock_collect_);
-    for (const Allocation& allocation : allocated_memory_) {
-        std::free(reinterpret_cast<void*>(allocation.ptr));
+    auto cache_locks = LockThreadCaches();
+    for (const auto& cache : thread_caches_) {
+        FlushThreadCache(cache.get());
     }
-    allocated_memory_.clear();
+    if (marking_) {
+        DrainMarking(true);
+    }
+    small_heap_.ReleaseAll();
+    large_space_.ReleaseAll();
+    allocations_.ForEach([this](const Allocation& alloc) {
+        page_map_.RemoveMedium(alloc.ptr, alloc.size);
+        std::free(reinterpret_cast<void*>(alloc.ptr));
+    });
+    allocations_.Clear();
 }
 
 GCImpl::~GCImpl() {
     scheduler_.Shutdown();
+    StopSweeper();
+    finalizers_.Stop();
     FreeAll();
 }
 
 void GCImpl::Init(const std::vector<Allocation>& roots) {
-    std::lock_guard<std::mutex> lock(lock_collect_);
-    roots_ = roots;
+    ReleaseRoots(roots_.UnlinkAddress(0, true));
+    for (const auto& root : roots) {
+        roots_.Add(root.ptr, root.size, false, true);
+    }
 }
 
 void GCImpl::AddRoot(const Allocation& root) {
-    std::lock_guard<std::mutex> lock(lock_collect_);
-    roots_.push_back(root);
+    roots_.Add(root.ptr, root.size, false, true);
 }
 
-bool operator==(const Allocation& lhs, const Allocation& rhs) {
-    return reinterpret_cast<uintptr_t>(lhs.ptr) == reinterpret_cast<uintptr_t>(rhs.ptr);
+void GCImpl::DeleteRoot(const Allocation& root) {
+    ReleaseRoots(roots_.UnlinkAddress(root.ptr, false));
 }
 
-void GCImpl::DeleteRoot(const Allocation& root) {
-    std::lock_guard<std::mutex> lock(lock_collect_);
-    std::erase(roots_, root);
+GCRootEntry* GCImpl::RegisterRoot(uintptr_t ptr, size_t size, bool hinted) {
+    return roots_.Add(ptr, size, hinted, false);
 }
 
-void GCImpl::CreateAllocation(uintptr_t ptr, size_t size, FinalizerT finalizer) {
+void GCImpl::UnregisterRoot(GCRootEntry* root) {
+    roots_.Unlink(root);
+    ReleaseRoots({root});
+}
+
+void GCImpl::RootChanged(GCRootEntry* root) {
+    root->changed.store(true);
+}
+
+// A collection that listed the roots before they were unlinked may still scan them or their
+// found words, the caller waits until it is done with the root chunks
+void GCImpl::ReleaseRoots(const std::vector<GCRootEntry*>& roots) {
+    if (roots.empty()) {
+        return;
+    }
+    uint32_t scanning;
+    while ((scanning = root_scan_.load()) != 0) {
+        root_scan_.wait(scanning);
+    }
+    for (GCRootEntry* root : roots) {
+        roots_.Release(root);
+    }
+}
+
+void* GCImpl::AllocateSmall(size_t size, FinalizerT finalizer, const GCLayout* layout) {
     Safepoint();
+    ThreadCache* cache = CurrentThreadCache();
+    if (cache != nullptr) {
+        std::unique_lock<std::mutex> cache_lock(cache->lock);
+        size_t size_class = SizeClassOf(size);
+        PageHeader*& page = cache->pages[KindOf(finalizer, layout)][size_class];
+        if (page != nullptr) {
+            if (void* ptr = SmallObjectHeap::AllocateInPage(page, size, finalizer, layout)) {
+                MarkAllocated(reinterpret_cast<uintptr_t>(ptr));
+                NoteCachedAllocation(cache, size);
+                return ptr;
+            }
+        }
+        // lock order is lock_collect_ before any thread cache
+        cache_lock.unlock();
+        std::lock_guard<std::mutex> lock(lock_collect_);
+        cache_lock.lock();
+        if (page != nullptr) {
+            small_heap_.ReturnPage(page);
+        }
+        page = small_heap_.AcquirePage(size, finalizer, layout);
+        if (page == nullptr) {
+            throw std::bad_alloc{};
+        }
+        card_table_.Cover(page->start, kPageSize);
+        NoteCachedAllocation(cache, size);
+        void* ptr = SmallObjectHeap::AllocateInPage(page, size, finalizer, layout);
+        MarkAllocated(reinterpret_cast<uintptr_t>(ptr));
+        return ptr;
+    }
     std::unique_lock<std::mutex> lock(lock_collect_);
-    allocated_memory_.push_back(Allocation{ptr, size, finalizer, timer_});
+    void* ptr = small_heap_.Allocate(size, finalizer, layout);
+    if (!ptr) {
+        throw std::bad_alloc{};
+    }
+    MarkAllocated(reinterpret_cast<uintptr_t>(ptr));
+    card_table_.Cover(reinterpret_cast<uintptr_t>(ptr), size);
+    NoteAllocation(size);
+    return ptr;
+}
+
+void* GCImpl::AllocateLarge(size_t size, FinalizerT finalizer, const GCLayout* layout) {
+    Safepoint();
+    std::lock_guard<std::mutex> lock(lock_collect_);
+    void* ptr = large_space_.Allocate(size, finalizer, layout);
+    if (!ptr) {
+        throw std::bad_alloc{};
+    }
+    MarkAllocated(reinterpret_cast<uintptr_t>(ptr));
+    card_table_.Cover(reinterpret_cast<uintptr_t>(ptr), size);
+    NoteAllocation(size);
+    return ptr;
+}
+
+void* GCImpl::AllocateLocked(size_t size, FinalizerT finalizer) {
+    void* ptr = nullptr;
+    if (IsSmallSize(size)) {
+        ptr = small_heap_.Allocate(size, finalizer);
+    } else if (IsLargeSize(size)) {
+        ptr = large_space_.Allocate(size, finalizer);
+    } else if ((ptr = std::malloc(size))) {
+        InsertAllocation(Allocation{reinterpret_cast<uintptr_t>(ptr), size, finalizer});
+    }
+    if (!ptr) {
+        throw std::bad_alloc{};
+    }
+    MarkAllocated(reinterpret_cast<uintptr_t>(ptr));
+    card_table_.Cover(reinterpret_cast<uintptr_t>(ptr), size);
+    NoteAllocation(size);
+    return ptr;
+}
+
+// Objects allocated while marking runs concurrently are born marked, nothing in the snapshot
+// points to them. Medium objects are marked by the allocation table when they are sealed
+void GCImpl::MarkAllocated(uintptr_t ptr) {
+    if (!marking_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    MemoryRange object;
+    const GCLayout* layout;
+    MarkEntry(page_map_.Get(ptr), ptr, &object, &layout);
+}
+
+void GCImpl::NoteAllocation(size_t size) {
     if (enable_auto_) {
         scheduler_.UpdateAllocationStats(size);
     }
-    ++timer_;
 }
 
-void GCImpl::DeleteAllocation(uintptr_t ptr) {
-    std::lock_guard<std::mutex> lock(lock_collect_);
-    Allocation fake_alloc{ptr, 0, nullptr, 0};
-    std::erase(allocated_memory_, fake_alloc);
+void GCImpl::NoteCachedAllocation(ThreadCache* cache, size_t size) {
+    cache->pending_bytes += size;
+    if (++cache->pending_calls < kStatsFlushCalls) {
+        return;
+    }
+    if (enable_auto_) {
+        scheduler_.UpdateAllocationStats(cache->pending_bytes, cache->pending_calls);
+    }
+    cache->pending_bytes = 0;
+    cache->pending_calls = 0;
 }
 
-bool operator<(const Allocation& lhs, const Allocation& rhs) {
-    return lhs.ptr < rhs.ptr;
+void GCImpl::CreateAllocation(uintptr_t ptr, size_t size, FinalizerT finalizer,
+                              const GCLayout* layout) {
+    Safepoint();
+    ThreadCache* cache = CurrentThreadCache();
+    if (cache != nullptr) {
+        // a thread stopped by a signal holds no lock the collector takes
+        std::unique_lock<std::mutex> cache_lock(cache->lock);
+        card_table_.Cover(ptr, size);
+        if (cache->log.size() < kAllocationLogSize) {
+            cache->log.push_back(Allocation{ptr, size, finalizer, layout});
+            NoteCachedAllocation(cache, size);
+            return;
+        }
+        cache_lock.unlock();
+    }
+    std::unique_lock<std::mutex> lock(lock_collect_);
+    if (cache != nullptr) {
+        std::lock_guard<std::mutex> cache_lock(cache->lock);
+        MergeAllocationLog(cache);
+    } else {
+        card_table_.Cover(ptr, size);
+    }
+    InsertAllocation(Allocation{ptr, size, finalizer, layout});
+    NoteAllocation(size);
 }
 
-void GCImpl::SortAllocations() {
-    std::sort(allocated_memory_.begin() + last_size_, allocated_memory_.end());
-    std::inplace_merge(allocated_memory_.begin(), allocated_memory_.begin() + last_size_,
-                       allocated_memory_.end());
+void GCImpl::InsertAllocation(const Allocation& alloc) {
+    page_map_.AddMedium(alloc.ptr, alloc.size);
+    allocations_.Insert(alloc);
 }
 
-bool GCImpl::IsValidAllocation(const Allocation& alloc) {
-    return alloc.last_valid_time >= timer_;
+// looks the allocation up without taking it, lock_collect_ must be held
+bool GCImpl::FindAllocation(uintptr_t ptr, Allocation* alloc) {
+    if (allocations_.Lookup(ptr, alloc)) {
+        return true;
+    }
+    auto contains = [ptr](const Allocation& entry) {
+        return entry.ptr <= ptr && ptr < entry.ptr + entry.size;
+    };
+    for (const auto& cache : thread_caches_) {
+        std::lock_guard<std::mutex> cache_lock(cache->lock);
+        auto it = std::find_if(cache->log.begin(), cache->log.end(), contains);
+        if (it != cache->log.end()) {
+            *alloc = *it;
+            return true;
+        }
+    }
+    return false;
+}
+
+// removes the allocation from the table, lock_collect_ must be held
+bool GCImpl::TakeAllocation(uintptr_t ptr, Allocation* alloc) {
+    // the memory goes back to malloc, no queued range may point into it
+    if (marking_) {
+        DrainMarking();
+    }
+    // allocation may still sit in a thread log
+    if (!allocations_.Erase(ptr, alloc)) {
+        MergeAllocationLogs();
+        if (!allocations_.Erase(ptr, alloc)) {
+            return false;
+        }
+    }
+    page_map_.RemoveMedium(alloc->ptr, alloc->size);
+    return true;
+}
+
+ThreadCache* GCImpl::CurrentThreadCache() {
+    return current_cache != nullptr && current_cache->gc == this ? current_cache : nullptr;
 }
 
-void* GCImpl::Malloc(size_t size, FinalizerT finalizer) {
+void GCImpl::FlushThreadCache(ThreadCache* cache) {
+    MergeAllocationLog(cache);
+    if (marking_) {
+        satb_.insert(satb_.end(), cache->satb.begin(), cache->satb.end());
+    }
+    cache->satb.clear();
+    for (auto& kind_pages : cache->pages) {
+        for (PageHeader*& page : kind_pages) {
+            if (page != nullptr) {
+                small_heap_.ReturnPage(page);
+                page = nullptr;
+            }
+        }
+    }
+    cache->pending_bytes = 0;
+    cache->pending_calls = 0;
+}
+
+void GCImpl::MergeAllocationLog(ThreadCache* cache) {
+    for (const Allocation& alloc : cache->log) {
+        InsertAllocation(alloc);
+    }
+    cache->log.clear();
+}
+
+void GCImpl::MergeAllocationLogs() {
+    for (const auto& cache : thread_caches_) {
+        std::lock_guard<std::mutex> cache_lock(cache->lock);
+        MergeAllocationLog(cache.get());
+    }
+}
+
+std::vector<std::unique_lock<std::mutex>> GCImpl::LockThreadCaches() {
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(thread_caches_.size());
+    for (const auto& cache : thread_caches_) {
+        locks.emplace_back(cache->lock);
+    }
+    return locks;
+}
+
+void* GCImpl::Malloc(size_t size, FinalizerT finalizer, const GCLayout* layout) {
+    if (IsSmallSize(size)) {
+        return AllocateSmall(size, finalizer, layout);
+    }
+    if (IsLargeSize(size)) {
+        return AllocateLarge(size, finalizer, layout);
+    }
     void* ptr = std::malloc(size);
     if (!ptr) {
         throw std::bad_alloc{};
     }
-    CreateAllocation(reinterpret_cast<uintptr_t>(ptr), size, finalizer);
+    CreateAllocation(reinterpret_cast<uintptr_t>(ptr), size, finalizer, layout);
     return ptr;
 }
 
+const GCLayout* GCImpl::MakeLayout(const uint64_t* bitmap, size_t num_words) {
+    if (num_words == 0) {
+        return nullptr;
+    }
+    auto layout = std::make_unique<GCLayout>(::MakeLayout(bitmap, num_words));
+    std::lock_guard<std::mutex> lock(lock_collect_);
+    layouts_.push_back(std::move(layout));
+    return layouts_.back().get();
+}
+
 void* GCImpl::Calloc(size_t nmemb, size_t size, FinalizerT finalizer) {
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        throw std::bad_alloc{};
+    }
+    if (IsSmallSize(nmemb * size)) {
+        void* ptr = AllocateSmall(nmemb * size, finalizer);
+        std::memset(ptr, 0, nmemb * size);
+        return ptr;
+    }
+    if (IsLargeSize(nmemb * size)) {
+        return AllocateLarge(nmemb * size, finalizer);
+    }
     void* ptr = std::calloc(nmemb, size);
     if (!ptr) {
         throw std::bad_alloc{};
@@ -102,26 +362,132 @@ void* GCImpl::Calloc(size_t nmemb, size_t size, FinalizerT finalizer) {
 }
 
 void* GCImpl::Realloc(void* ptr, size_t size, FinalizerT finalizer) {
-    DeleteAllocation(reinterpret_cast<uintptr_t>(ptr));
+    if (ptr == nullptr) {
+        return Malloc(size, finalizer);
+    }
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    Safepoint();
+    std::unique_lock<std::mutex> lock(lock_collect_);
+    if (PageHeader* page = small_heap_.FindPage(addr)) {
+        // like unknown pointers, interior ones and objects being freed are left alone
+        size_t slot = page->SlotOf(addr);
+        if (slot == kInvalidSlot || page->ObjectStart(slot) != addr || page->IsFinalizing(slot)) {
+            return nullptr;
+        }
+        void* new_ptr = AllocateLocked(size, finalizer);
+        std::memcpy(new_ptr, reinterpret_cast<void*>(page->ObjectStart(slot)),
+                    std::min<size_t>(size, page->object_size));
+        LogObject(page->ObjectStart(slot), page->object_size);
+        small_heap_.Release(page, slot);
+        return new_ptr;
+    }
+    if (LargeObject* large = large_space_.Find(addr)) {
+        if (large->ptr != addr || large->finalizing) {
+            return nullptr;
+        }
+        // the new object is born marked, what the old one points to is traced from the log
+        LogObject(large->ptr, large->size);
+        // the mapping may move or go away, no queued range may point into it
+        if (marking_) {
+            DrainMarking();
+        }
+        if (IsLargeSize(size)) {
+            void* new_ptr = large_space_.Reallocate(large, size, finalizer);
+            if (!new_ptr) {
+                throw std::bad_alloc{};
+            }
+            MarkAllocated(reinterpret_cast<uintptr_t>(new_ptr));
+            card_table_.Cover(reinterpret_cast<uintptr_t>(new_ptr), size);
+            NoteAllocation(size);
+            return new_ptr;
+        }
+        void* new_ptr = AllocateLocked(size, finalizer);
+        std::memcpy(new_ptr, reinterpret_cast<void*>(large->ptr), size);
+        large_space_.Free(large);
+        return new_ptr;
+    }
+    // checked before anything is taken out of the table, and the old entry stays until the new
+    // memory is there, so a failed realloc leaves the object as it was
+    Allocation old;
+    if (!FindAllocation(addr, &old) || old.ptr != addr) {
+        return nullptr;
+    }
+    // the memory goes back to malloc, no queued range may point into it
+    if (marking_) {
+        DrainMarking();
+    }
+    LogObject(old.ptr, old.size);
+    // the table only holds objects bigger than a card, one that changes tier is copied out
+    if (IsSmallSize(size) || IsLargeSize(size)) {
+        void* new_ptr = AllocateLocked(size, finalizer);
+        TakeAllocation(addr, &old);
+        std::memcpy(new_ptr, ptr, std::min(size, old.size));
+        std::free(ptr);
+        return new_ptr;
+    }
     void* new_ptr = std::realloc(ptr, size);
     if (!new_ptr) {
         throw std::bad_alloc{};
     }
-    CreateAllocation(reinterpret_cast<uintptr_t>(new_ptr), size, finalizer);
+    TakeAllocation(addr, &old);
+    InsertAllocation(Allocation{reinterpret_cast<uintptr_t>(new_ptr), size, finalizer});
+    MarkAllocated(reinterpret_cast<uintptr_t>(new_ptr));
+    card_table_.Cover(reinterpret_cast<uintptr_t>(new_ptr), size);
+    NoteAllocation(size);
     return new_ptr;
 }
 
+// The object is put out of reach of sweeps under the lock and finalized once the lock is
+// released, as finalizers may call into the collector. Its memory is freed after that
 void GCImpl::Free(uintptr_t ptr) {
     if (ptr == 0) {
         return;
     }
-    Allocation* alloc = FindAllocation<false>(ptr);
-    if (alloc == nullptr) {
+    std::unique_lock<std::mutex> lock(lock_collect_);
+    PageHeader* page = small_heap_.FindPage(ptr);
+    if (page != nullptr) {
+        size_t slot = page->SlotOf(ptr);
+        if (slot == kInvalidSlot || page->IsFinalizing(slot)) {
+            return;
+        }
+        uintptr_t start = page->ObjectStart(slot);
+        size_t size = page->object_size;
+        FinalizerT finalizer = page->GetFinalizer(slot);
+        if (IsFinalizable(finalizer)) {
+            page->SetFinalizing(slot);
+            lock.unlock();
+            finalizer(reinterpret_cast<void*>(start), size);
+            lock.lock();
+        }
+        LogObject(start, size);
+        small_heap_.Release(page, slot);
+        return;
+    }
+    if (LargeObject* large = large_space_.Find(ptr)) {
+        if (large->finalizing) {
+            return;
+        }
+        if (IsFinalizable(large->finalizer)) {
+            large->finalizing = true;
+            lock.unlock();
+            large->finalizer(reinterpret_cast<void*>(large->ptr), large->size);
+            lock.lock();
+        }
+        LogObject(large->ptr, large->size);
+        if (marking_) {
+            DrainMarking();
+        }
+        large_space_.Free(large);
         return;
     }
-    alloc->finalizer(reinterpret_cast<void*>(alloc->ptr), alloc->size);
-    std::free(reinterpret_cast<void*>(alloc->ptr));
-    DeleteAllocation(alloc->ptr);
+    Allocation alloc;
+    if (!TakeAllocation(ptr, &alloc)) {
+        return;
+    }
+    LogObject(alloc.ptr, alloc.size);
+    lock.unlock();
+    alloc.finalizer(reinterpret_cast<void*>(alloc.ptr), alloc.size);
+    std::free(reinterpret_cast<void*>(alloc.ptr));
 }
 
 GCScheduler& GCImpl::GetScheduler() {
@@ -135,8 +501,16 @@ const GCScheduler& GCImpl::GetScheduler() const {
 void GCImpl::DisableScheduler() {
     std::lock_guard<std::mutex> lock(threads_registering_);
     scheduler_.Stop();
+    // blocking threads that aren't waited for must not count as stopped either
+    for (auto& [id, cache] : threads_) {
+        if (cache->blocking) {
+            cache->blocking = false;
+            world_.fetch_sub(1);
+        }
+    }
     threads_.clear();
     threads_count_ = 0;
+    NotifyStopEvent();
     enable_auto_ = false;
 }
 
@@ -145,19 +519,148 @@ void GCImpl::EnableScheduler() {
     enable_auto_ = true;
 }
 
-void GCImpl::Safepoint() {
-    if (!should_stop_.load()) {
+void GCImpl::SetWorkerThreads(size_t count) {
+    std::lock_guard<std::mutex> lock(lock_collect_);
+    worker_threads_ = std::min(count, kMaxMarkWorkers);
+}
+
+size_t GCImpl::GetWorkerThreads() {
+    std::lock_guard<std::mutex> lock(lock_collect_);
+    return NumWorkers();
+}
+
+// one worker per core unless set by the user
+size_t GCImpl::NumWorkers() const {
+    if (worker_threads_ != 0) {
+        return worker_threads_;
+    }
+    return std::clamp<size_t>(std::thread::hardware_concurrency(), 1, kMaxMarkWorkers);
+}
+
+void GCImpl::SetWorkerAffinity(const std::vector<int>& cpus) {
+    std::lock_guard<std::mutex> lock(lock_collect_);
+    workers_.SetAffinity(cpus);
+}
+
+void GCImpl::SetGenerational(bool enable) {
+    generational_ = enable;
+}
+
+bool GCImpl::IsGenerational() const {
+    return generational_;
+}
+
+void GCImpl::SetBackgroundSweep(bool enable) {
+    background_sweep_ = enable;
+}
+
+void GCImpl::SetConcurrentMark(bool enable) {
+    concurrent_mark_ = enable;
+}
+
+bool GCImpl::SetDirtyPageMark(bool enable) {
+    std::lock_guard<std::mutex> lock(lock_collect_);
+    // the tracker stays open once enabled, a running mark may still depend on it
+    if (enable && !dirty_pages_.Enable()) {
+        return false;
+    }
+    dirty_page_mark_ = enable;
+    return true;
+}
+
+bool GCImpl::SetStackRoots(bool enable) {
+    // the way the world is stopped doesn't change within a cycle
+    std::lock_guard<std::mutex> cycle(lock_cycle_);
+    if (enable && !InstallSuspendHandlers()) {
+        return false;
+    }
+    stack_roots_ = enable;
+    return true;
+}
+
+void GCImpl::SetAsyncFinalizers(bool enable) {
+    async_finalizers_ = enable;
+}
+
+FinalizerExecutor& GCImpl::GetFinalizerExecutor() {
+    return finalizers_;
+}
+
+void GCImpl::WaitSweep() {
+    std::lock_guard<std::mutex> lock(lock_collect_);
+    FinishSweep();
+}
+
+// a safepoint that saw a stop, the flag may be stale and LeaveStopped returns at once then
+void GCImpl::Park() {
+    world_.fetch_add(1);
+    NotifyStopEvent();
+    LeaveStopped();
+}
+
+// only threads in threads_ are counted, a stop waits for threads_count_ of them
+void GCImpl::EnterBlocking() {
+    std::lock_guard<std::mutex> lock(threads_registering_);
+    auto it = threads_.find(std::this_thread::get_id());
+    if (it == threads_.end()) {
         return;
     }
-    std::unique_lock<std::mutex> lock(lock_collect_);
-    ++stopped_;
-    stopping_thread_.wait(lock, [this]() { return !should_stop_.load(); });
-    --stopped_;
+    it->second->blocking = true;
+    if (world_.fetch_add(1) & kStopRequested) {
+        NotifyStopEvent();
+    }
+}
+
+void GCImpl::LeaveBlocking() {
+    ThreadCache* cache = CurrentThreadCache();
+    if (cache == nullptr) {
+        return;
+    }
+    {
+        // DisableScheduler may have taken the thread out of the count already
+        std::lock_guard<std::mutex> lock(threads_registering_);
+        if (!cache->blocking) {
+            return;
+        }
+        cache->blocking = false;
+    }
+    LeaveStopped();
+}
+
+// the thread stays counted as stopped until the world resumes, so a stop requested meanwhile
+// never waits for it
+void GCImpl::LeaveStopped() {
+    uint32_t world = world_.load();
+    while (true) {
+        if (world & kStopRequested) {
+            uint32_t resumes = resumes_.load();
+            if (world_.load() & kStopRequested) {
+                resumes_.wait(resumes);
+            }
+            world = world_.load();
+        } else if (world_.compare_exchange_weak(world, world - 1)) {
+            return;
+        }
+    }
+}
+
+void GCImpl::NotifyStopEvent() {
+    stop_events_.fetch_add(1);
+    stop_events_.notify_one();
 }
 
 void GCImpl::RegisterThread() {
     std::lock_guard<std::mutex> lock(threads_registering_);
-    threads_.insert(std::this_thread::get_id());
+    if (CurrentThreadCache() == nullptr) {
+        auto cache = std::make_unique<ThreadCache>();
+        cache->gc = this;
+        cache->log.reserve(kAllocationLogSize);
+        AttachThreadStack(&cache->stack);
+        current_cache = cache.get();
+        std::lock_guard<std::mutex> collect_lock(lock_collect_);
+        thread_caches_.push_back(std::move(cache));
+    }
+    threads_[std::this_thread::get_id()] = CurrentThreadCache();
     threads_count_ = threads_.size();
 }
 
@@ -165,129 +668,918 @@ void GCImpl::DeregisterThread() {
     std::lock_guard<std::mutex> lock(threads_registering_);
     threads_.erase(std::this_thread::get_id());
     threads_count_ = threads_.size();
+    NotifyStopEvent();
+    ThreadCache* cache = CurrentThreadCache();
+    if (cache != nullptr) {
+        std::lock_guard<std::mutex> collect_lock(lock_collect_);
+        {
+            std::lock_guard<std::mutex> cache_lock(cache->lock);
+            FlushThreadCache(cache);
+        }
+        std::erase_if(thread_caches_, [cache](const auto& other) { return other.get() == cache; });
+        DetachThreadStack();
+        current_cache = nullptr;
+    }
 }
 
-void GCImpl::StopWorld() {
-    should_stop_ = true;
-    while (stopped_ < threads_count_) {
-        std::this_thread::yield();
+std::vector<std::unique_lock<std::mutex>> GCImpl::StopWorld(std::unique_lock<std::mutex>* lock) {
+    stop_start_ = std::chrono::steady_clock::now();
+    signal_stop_ = stack_roots_;
+    if (signal_stop_) {
+        // the locks are taken first, so no stopped thread holds one of them. A thread cache
+        // changes only under its lock, registering needs lock_collect_ and roots change under
+        // the lock of the registry. The threads keep running until SuspendWorld
+        lock->lock();
+        auto cache_locks = LockThreadCaches();
+        cache_locks.emplace_back(roots_.Lock());
+        return cache_locks;
+    }
+    // a registered thread that drives a collection through Step doesn't stop itself
+    size_t self;
+    {
+        std::lock_guard<std::mutex> registering(threads_registering_);
+        self = threads_.contains(std::this_thread::get_id()) ? 1 : 0;
+    }
+    world_.fetch_or(kStopRequested);
+    poll_page_.Arm();
+    while (true) {
+        // read before the check, a thread stopping after it changes the count
+        uint32_t events = stop_events_.load();
+        if ((world_.load() & ~kStopRequested) + self >= threads_count_) {
+            break;
+        }
+        stop_events_.wait(events);
+    }
+    lock->lock();
+    RecordTimeToSafepoint();
+    return LockThreadCaches();
+}
+
+// Stops the threads of a stop with signals, StopWorld stopped the others already. A suspended
+// thread may hold a lock of malloc, so nothing up to ResumeWorld allocates or frees: what the
+// pause needs is prepared before, sweeping and finalizing come after
+void GCImpl::SuspendWorld() {
+    if (!signal_stop_) {
+        return;
+    }
+    ThreadCache* self = CurrentThreadCache();
+    suspended_.clear();
+    for (const auto& cache : thread_caches_) {
+        if (cache.get() == self) {
+            SaveThreadStack(&cache->stack);
+        } else {
+            suspended_.push_back(&cache->stack);
+        }
     }
+    SuspendThreads(suspended_);
+    RecordTimeToSafepoint();
+}
+
+void GCImpl::RecordTimeToSafepoint() {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - stop_start_)
+                  .count();
+    stats_.last_time_to_safepoint_ns = ns;
+    stats_.max_time_to_safepoint_ns = std::max<uint64_t>(stats_.max_time_to_safepoint_ns, ns);
 }
 
 void GCImpl::ResumeWorld() {
-    should_stop_ = false;
-    stopping_thread_.notify_all();
-}
-
-void GCImpl::CollectPrepare() {
-    ++timer_;
-    SortAllocations();
-    prev_find_ = allocated_memory_.end();
-}
-
-std::vector<Allocation*> GCImpl::MarkRoots() {
-    std::vector<Allocation*> live;
-    for (const auto& root : roots_) {
-        uintptr_t start = reinterpret_cast<uintptr_t>(root.ptr);
-        uintptr_t end = start + root.size - kSize + 1;
-        for (uintptr_t ptr = start; ptr < end; ptr += kSize) {
-            Allocation* alloc = FindAllocation<true>(GetMemoryPtr(ptr));
-            if (alloc != nullptr) {
-                alloc->last_valid_time = timer_;
-                if (alloc->size >= kSize) {
-                    live.push_back(alloc);
-                }
+    if (signal_stop_) {
+        ResumeThreads(suspended_);
+        suspended_.clear();
+        return;
+    }
+    // parked threads read the page again once they leave
+    poll_page_.Disarm();
+    world_.fetch_and(~kStopRequested);
+    resumes_.fetch_add(1);
+    resumes_.notify_all();
+}
+
+void GCImpl::CollectPrepare(CollectionKind kind) {
+    for (const auto& cache : thread_caches_) {
+        FlushThreadCache(cache.get());
+    }
+    allocations_.Seal();
+    // marks are sticky between full collections, a marked object is an old one
+    if (kind == CollectionKind::kFull) {
+        allocations_.ClearMarks();
+        small_heap_.ClearMarks();
+        large_space_.ClearMarks();
+    }
+}
+
+// marks the small or large object that ptr points into
+bool GCImpl::MarkEntry(PageMapEntry entry, uintptr_t ptr, MemoryRange* object,
+                       const GCLayout** layout) {
+    if (PageHeader* page = SmallObjectHeap::FindPage(entry)) {
+        size_t slot = page->SlotOf(ptr);
+        if (slot == kInvalidSlot || !page->TestAndMark(slot)) {
+            return false;
+        }
+        *object = MemoryRange{page->ObjectStart(slot), page->object_size};
+        *layout = page->GetLayout(slot);
+        return true;
+    }
+    if (LargeObject* large = LargeObjectSpace::Find(entry, ptr)) {
+        if (!large->TestAndMark()) {
+            return false;
+        }
+        *object = MemoryRange{large->ptr, large->size};
+        *layout = large->layout;
+        return true;
+    }
+    return false;
+}
+
+// Small and large objects are marked right away. Pointers that may point into medium objects are
+// queued and looked up in batches, see FlushMediumCandidates. Newly marked objects go to the
+// worker's queue
+void GCImpl::MarkRange(uintptr_t start, uintptr_t end, MarkWorker* worker) {
+    ScanRange(start, end, [this, worker](uintptr_t ptr) {
+        PageMapEntry entry = page_map_.Get(ptr);
+        MemoryRange object;
+        const GCLayout* layout;
+        if (MarkEntry(entry, ptr, &object, &layout)) {
+            PushMarked(worker, object, layout);
+            return;
+        }
+        if (entry.MediumCount() != 0) {
+            worker->candidates.push_back(ptr);
+            if (worker->candidates.size() >= kMarkBatchSize) {
+                FlushMediumCandidates(worker);
             }
         }
+    });
+}
+
+// a sorted batch is merge-joined with the sorted runs of the table instead of searching the
+// table once per pointer
+void GCImpl::FlushMediumCandidates(MarkWorker* worker) {
+    SortAddresses(&worker->candidates, &worker->scratch);
+    allocations_.MarkSorted(
+        worker->candidates.data(), worker->candidates.size(),
+        [this, worker](const Allocation& alloc) {
+            PushMarked(worker, {alloc.ptr, alloc.size}, alloc.layout);
+        });
+    worker->candidates.clear();
+}
+
+// Typed objects are queued as the runs of their pointer words, adjacent runs merged, and
+// pointer-free objects not at all
+void GCImpl::PushMarked(MarkWorker* worker, MemoryRange object, const GCLayout* layout) {
+    if (layout == nullptr) {
+        PushRange(worker, object);
+        return;
+    }
+    MemoryRange pending{0, 0};
+    layout->ForEachRun(object.ptr, object.ptr, object.ptr + object.size,
+                       [this, worker, &pending](uintptr_t start, uintptr_t end) {
+                           if (pending.ptr + pending.size == start) {
+                               pending.size += end - start;
+                               return;
+                           }
+                           PushRange(worker, pending);
+                           pending = MemoryRange{start, end - start};
+                       });
+    PushRange(worker, pending);
+}
+
+// big ranges are queued in pieces, so several workers can scan them
+void GCImpl::PushRange(MarkWorker* worker, MemoryRange range) {
+    if (range.size < kSize) {
+        return;
+    }
+    // the line is on its way while the range waits in the queue
+    __builtin_prefetch(reinterpret_cast<const void*>(range.ptr));
+    for (size_t offset = 0; offset < range.size; offset += kMarkChunkSize) {
+        worker->queue.push(
+            MemoryRange{range.ptr + offset, std::min(kMarkChunkSize, range.size - offset)});
     }
-    return live;
 }
 
-void GCImpl::MarkHeapAllocs(const std::vector<Allocation*>& live_allocs) {
-    for (Allocation* alloc : live_allocs) {
-        uintptr_t heap_start = Aligned(reinterpret_cast<uintptr_t>(alloc->ptr));
-        uintptr_t heap_end = reinterpret_cast<uintptr_t>(alloc->ptr) + alloc->size - kSize + 1;
-        for (uintptr_t ptr = heap_start; ptr < heap_end; ptr += kSize) {
-            Allocation* heap_alloc = FindAllocation<true>(GetMemoryPtr(ptr));
-            if (heap_alloc != nullptr) {
-                heap_alloc->last_valid_time = timer_;
+// ranges are split into pieces that workers claim one by one in MarkRoots
+void GCImpl::AddMarkChunks(uintptr_t start, size_t size) {
+    for (size_t offset = 0; offset < size; offset += kMarkChunkSize) {
+        root_chunks_.push_back(
+            MemoryRange{start + offset, std::min(kMarkChunkSize, size - offset)});
+    }
+}
+
+void GCImpl::AddRootChunks() {
+    root_chunks_.clear();
+    next_root_chunk_.store(0);
+    {
+        // a stop with signals took the lock before the threads were stopped
+        std::unique_lock<std::mutex> registry(roots_.Lock(), std::defer_lock);
+        if (!signal_stop_) {
+            registry.lock();
+        }
+        root_scan_.store(1);
+        root_scanners_.store(workers_.Size());
+        roots_.ForEach([this](GCRootEntry* root) { AddRegisteredRoot(root); });
+    }
+    if (signal_stop_) {
+        // every registered thread is stopped or is the collecting one
+        for (const auto& cache : thread_caches_) {
+            const ThreadStack& stack = cache->stack;
+            if (stack.base != 0) {
+                uintptr_t top = stack.top & ~static_cast<uintptr_t>(kAlignment - 1);
+                AddMarkChunks(top, stack.base - top);
             }
+            AddMarkChunks(reinterpret_cast<uintptr_t>(stack.registers), sizeof(stack.registers));
         }
     }
 }
 
-void GCImpl::MarkParallel() {
-    size_t num_threads = std::thread::hardware_concurrency();
-    size_t idx = 0;
+// Makes room for what AddRootChunks adds and extra_bytes more, a stop with signals does it before
+// the threads are suspended. The registry lock is held then and stacks can't outgrow their limit
+void GCImpl::ReserveRootChunks(size_t extra_bytes) {
+    if (!signal_stop_) {
+        return;
+    }
+    auto chunks = [](size_t size) { return (size + kMarkChunkSize - 1) / kMarkChunkSize; };
+    size_t count = chunks(extra_bytes);
+    roots_.ForEach([&count, &chunks](GCRootEntry* root) { count += chunks(root->size); });
+    for (const auto& cache : thread_caches_) {
+        const ThreadStack& stack = cache->stack;
+        count += chunks(stack.base - stack.limit) + chunks(sizeof(stack.registers));
+    }
+    root_chunks_.reserve(count);
+}
+
+void GCImpl::MarkRoots(MarkWorker* worker) {
+    size_t index;
+    while ((index = next_root_chunk_.fetch_add(1)) < root_chunks_.size()) {
+        const MemoryRange& chunk = root_chunks_[index];
+        MarkRange(chunk.ptr, chunk.ptr + chunk.size, worker);
+    }
+    // the last worker of a root scan lets unregistering threads release their roots
+    if (root_scanners_.load() != 0 && root_scanners_.fetch_sub(1) == 1) {
+        root_scan_.store(0);
+        root_scan_.notify_all();
+    }
+}
+
+// Hinted roots are scanned in full only when they changed since the last collection, otherwise
+// the words that pointed into the heap then are scanned. A thread stopped with a signal may be
+// between a store to the root and its hint, so those stops scan them in full, without touching
+// the found words as they must not allocate
+void GCImpl::AddRegisteredRoot(GCRootEntry* root) {
+    if (!root->hinted || signal_stop_) {
+        AddMarkChunks(root->ptr, root->size);
+        return;
+    }
+    if (root->changed.exchange(false)) {
+        root->found.clear();
+        ScanRange(root->ptr, root->ptr + root->size,
+                  [root](uintptr_t ptr) { root->found.push_back(ptr); });
+    }
+    AddMarkChunks(reinterpret_cast<uintptr_t>(root->found.data()),
+                  root->found.size() * sizeof(uintptr_t));
+}
+
+// Old objects are not traced by minor collections, the write barrier dirties the cards where
+// they got pointers to younger objects, so only those parts of them are scanned. Collect clears
+// the cards once the mark is done
+void GCImpl::MarkDirtyCards(MarkWorker* worker) {
+    card_table_.ForEachDirty([this, worker](uintptr_t card) { ScanMarkedCard(card, worker); });
+}
+
+// scans the parts of the marked objects that lie on the card
+void GCImpl::ScanMarkedCard(uintptr_t card, MarkWorker* worker) {
+    if (PageHeader* page = small_heap_.FindPage(card)) {
+        size_t first = (card - page->start) / page->object_size;
+        size_t last = (card + kCardSize - 1 - page->start) / page->object_size;
+        for (size_t slot = first; slot <= last && slot < page->num_objects; ++slot) {
+            if (page->IsAllocated(slot) && page->IsMarked(slot)) {
+                uintptr_t start = page->ObjectStart(slot);
+                ScanCard(card, start, start + page->object_size, page->GetLayout(slot), worker);
+            }
+        }
+        return;
+    }
+    if (LargeObject* large = large_space_.Find(card)) {
+        if (large->marked) {
+            ScanCard(card, large->ptr, large->ptr + large->size, large->layout, worker);
+        }
+        return;
+    }
+    // medium objects are bigger than a card, so at most two of them overlap it
+    AllocationRef first, last;
+    bool has_first = allocations_.Find(card, &first);
+    bool has_last = allocations_.Find(card + kCardSize - 1, &last);
+    if (has_first && AllocationTable::IsMarked(first)) {
+        const Allocation& alloc = first.Get();
+        ScanCard(card, alloc.ptr, alloc.ptr + alloc.size, alloc.layout, worker);
+    }
+    if (has_last && (!has_first || last != first) && AllocationTable::IsMarked(last)) {
+        const Allocation& alloc = last.Get();
+        ScanCard(card, alloc.ptr, alloc.ptr + alloc.size, alloc.layout, worker);
+    }
+}
 
-    std::vector<WorkStealingQueue<const Allocation*>> ws_queues(num_threads);
-    for (const Allocation& root : roots_) {
-        ws_queues[idx % num_threads].push(&root);
-        ++idx;
+void GCImpl::ScanCard(uintptr_t card, uintptr_t start, uintptr_t end, const GCLayout* layout,
+                      MarkWorker* worker) {
+    uintptr_t scan_start = Aligned(std::max(card, start));
+    uintptr_t scan_end = std::min(card + kCardSize, end);
+    if (layout == nullptr) {
+        MarkRange(scan_start, scan_end, worker);
+        return;
     }
+    layout->ForEachRun(start, scan_start, scan_end, [this, worker](uintptr_t from, uintptr_t to) {
+        MarkRange(from, to, worker);
+    });
+}
+
+// the worker count stays fixed until the next collection, the queues of all workers are drained
+void GCImpl::PrepareMarkWorkers() {
+    size_t num_workers = NumWorkers();
+    workers_.Resize(num_workers);
+    while (mark_workers_.size() < num_workers) {
+        mark_workers_.push_back(std::make_unique<MarkWorker>());
+    }
+}
 
-    auto mark_worker = [this, &ws_queues, num_threads](size_t id) {
-        WorkStealingQueue<const Allocation*>& local_queue = ws_queues[id];
-        const Allocation* current_alloc = nullptr;
+// Scans the root chunks and traces everything reachable from them and from the objects already
+// queued. Each worker drains its own queue and steals from the others when it runs dry. A worker
+// only becomes idle with an empty queue and no pending candidates, so once all of them are idle
+// there is no work left.
+void GCImpl::MarkParallel() {
+    size_t num_workers = workers_.Size();
+    active_markers_.store(num_workers);
+    workers_.Run([this, num_workers](size_t id) {
+        MarkRoots(mark_workers_[id].get());
+        MarkLoop(id, num_workers);
+    });
+}
+
+void GCImpl::MarkLoop(size_t id, size_t num_workers) {
+    MarkWorker* worker = mark_workers_[id].get();
+    MemoryRange range;
+    while (true) {
+        if (TakeMarkWork(id, num_workers, &range)) {
+            MarkRange(Aligned(range.ptr), range.ptr + range.size, worker);
+            continue;
+        }
+        // the batch may point to more objects
+        if (!worker->candidates.empty()) {
+            FlushMediumCandidates(worker);
+            continue;
+        }
+        active_markers_.fetch_sub(1);
         while (true) {
-            if (!local_queue.pop(current_alloc)) {
-                bool stolen = false;
-                for (size_t i = 0; i < num_threads; ++i) {
-                    if (i == id) {
-                        continue;
-                    }
-                    if (ws_queues[i].steal(current_alloc)) {
-                        stolen = true;
-                        break;
-                    }
-                }
-                if (!stolen) {
-                    break;
-                }
+            if (active_markers_.load() == 0) {
+                return;
+            }
+            if (!HasMarkWork(id, num_workers)) {
+                std::this_thread::yield();
+                continue;
             }
+            // counted as active before taking work, so others can't see zero meanwhile
+            active_markers_.fetch_add(1);
+            if (StealMarkWork(id, num_workers, &range)) {
+                MarkRange(Aligned(range.ptr), range.ptr + range.size, worker);
+                break;
+            }
+            active_markers_.fetch_sub(1);
+        }
+    }
+}
+
+// appends to the worker's FIFO and starts loading the first lines of the range
+static void PushPrefetched(MarkWorker* worker, const MemoryRange& range) {
+    uintptr_t end = range.ptr + std::min(range.size, kMarkPrefetchBytes);
+    for (uintptr_t line = range.ptr; line < end; line += kCacheLineSize) {
+        __builtin_prefetch(reinterpret_cast<const void*>(line));
+    }
+    size_t tail = (worker->prefetch_head + worker->prefetch_count) % kMarkPrefetchDepth;
+    worker->prefetched[tail] = range;
+    ++worker->prefetch_count;
+}
 
-            uintptr_t heap_start = Aligned(reinterpret_cast<uintptr_t>(current_alloc->ptr));
-            uintptr_t heap_end =
-                reinterpret_cast<uintptr_t>(current_alloc->ptr) + current_alloc->size - kSize + 1;
-            for (uintptr_t ptr = heap_start; ptr < heap_end; ptr += kSize) {
-                Allocation* child_alloc = FindAllocation<false>(GetMemoryPtr(ptr));
-                if (child_alloc != nullptr && child_alloc->last_valid_time < timer_) {
-                    child_alloc->last_valid_time = timer_;
+// Popped ranges pass through a small FIFO before they are scanned, like in Boehm's mark stack.
+// Their first cache lines are prefetched as they enter it, so the loads of several objects
+// overlap instead of every object starting with a miss. Other queues are only stolen from
+// once the own queue and the FIFO are empty
+bool GCImpl::TakeMarkWork(size_t id, size_t num_workers, MemoryRange* range) {
+    MarkWorker* worker = mark_workers_[id].get();
+    if (worker->prefetch_count == 0) {
+        if (!worker->queue.pop(*range)) {
+            return StealMarkWork(id, num_workers, range);
+        }
+        // nothing to overlap it with, as after every node of a list
+        if (worker->queue.empty()) {
+            return true;
+        }
+        PushPrefetched(worker, *range);
+    }
+    MemoryRange next;
+    // checked first, a failing pop costs a fence
+    while (worker->prefetch_count < kMarkPrefetchDepth && !worker->queue.empty() &&
+           worker->queue.pop(next)) {
+        PushPrefetched(worker, next);
+    }
+    *range = worker->prefetched[worker->prefetch_head];
+    worker->prefetch_head = (worker->prefetch_head + 1) % kMarkPrefetchDepth;
+    --worker->prefetch_count;
+    return true;
+}
 
-                    local_queue.push(child_alloc);
-                }
+bool GCImpl::HasMarkWork(size_t id, size_t num_workers) const {
+    for (size_t i = 1; i < num_workers; ++i) {
+        if (!mark_workers_[(id + i) % num_workers]->queue.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool GCImpl::StealMarkWork(size_t id, size_t num_workers, MemoryRange* range) {
+    for (size_t i = 1; i < num_workers; ++i) {
+        if (mark_workers_[(id + i) % num_workers]->queue.steal(*range)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Full collection with concurrent marking. The first pause only scans the roots, then the
+// workers trace in short steps under lock_collect_ while mutators run and log the pointers they
+// overwrite. The remark pause traces what was logged and leaves the sweep to the sweeper thread,
+// so neither pause grows with the heap. A cycle started by Step is carried on from where it is
+void GCImpl::CollectConcurrent() {
+    std::unique_lock<std::mutex> lock(lock_collect_);
+    GCWorkerPool::CallerAffinity pinned(workers_);
+    if (!marking_) {
+        lock.unlock();
+        StartMarking();
+        lock.lock();
+    }
+    while (MarkStep()) {
+        // mutators waiting for the lock get in between steps
+        lock.unlock();
+        std::this_thread::yield();
+        lock.lock();
+    }
+    lock.unlock();
+    FinishMarking(true);
+}
+
+// the pause that starts a concurrent mark, it clears the marks and scans the roots
+void GCImpl::StartMarking() {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(lock_collect_, std::defer_lock);
+    auto cache_locks = StopWorld(&lock);
+    FinishSweep();
+    CollectPrepare(CollectionKind::kFull);
+    card_table_.Clear();
+    PrepareMarkWorkers();
+    ReserveRootChunks(0);
+    rescan_dirty_ = dirty_page_mark_ && dirty_pages_.Mechanism() != DirtyTracking::kNone;
+    if (rescan_dirty_ && dirty_pages_.ProtectsRanges()) {
+        UpdateHeapSpans();
+    }
+    SuspendWorld();
+    AddRootChunks();
+    workers_.Run([this](size_t id) { MarkRoots(mark_workers_[id].get()); });
+    if (rescan_dirty_) {
+        // writes from here on are found by the remark pause
+        dirty_pages_.Clear();
+        if (dirty_pages_.ProtectsRanges()) {
+            for (const MemoryRange& span : heap_spans_) {
+                dirty_pages_.Protect(span.ptr, span.size);
             }
         }
-    };
+    }
+    marking_ = true;
+    allocations_.SetAllocateMarked(true);
+    ResumeWorld();
+    cache_locks.clear();
+    mark_pause_ = std::chrono::steady_clock::now() - start;
+    lock.unlock();
+}
 
-    std::vector<std::thread> workers;
-    for (size_t i = 0; i < num_threads; ++i) {
-        workers.emplace_back(mark_worker, i);
+// The remark pause, it traces what is left and prepares the sweep. The sweeper thread is woken
+// for it unless the caller sweeps in steps
+void GCImpl::FinishMarking(bool wake_sweeper) {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(lock_collect_, std::defer_lock);
+    auto cache_locks = StopWorld(&lock);
+    // hands over the logs of overwritten pointers, medium objects allocated meanwhile are sealed
+    // marked
+    for (const auto& cache : thread_caches_) {
+        FlushThreadCache(cache.get());
     }
-    for (auto& worker : workers) {
-        worker.join();
+    allocations_.Seal();
+    ReserveRootChunks(satb_.size() * sizeof(uintptr_t));
+    if (rescan_dirty_) {
+        UpdateHeapSpans();
     }
+    SuspendWorld();
+    if (rescan_dirty_) {
+        RescanDirty();
+    }
+    DrainMarking(true);
+    marking_ = false;
+    allocations_.SetAllocateMarked(false);
+    ResumeWorld();
+    SweepInBackground(wake_sweeper);
+    cache_locks.clear();
+    mark_pause_ += std::chrono::steady_clock::now() - start;
+    RecordPause(CollectionKind::kFull,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(mark_pause_).count());
+    lock.unlock();
 }
 
+// Runs the current cycle for about budget, starting one if there is none: marking in steps,
+// the remark pause once nothing is left to trace, then the sweep in steps. Returns true once
+// the cycle is complete. Pauses are not split, so a call may overrun its budget by the remark
+bool GCImpl::Step(std::chrono::nanoseconds budget) {
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    std::unique_lock<std::mutex> cycle(lock_cycle_, std::try_to_lock);
+    // a collection runs on another thread
+    if (!cycle.owns_lock()) {
+        return false;
+    }
+    if (!stepping_) {
+        StartMarking();
+        stepping_ = true;
+    }
+    std::unique_lock<std::mutex> lock(lock_collect_);
+    while (marking_) {
+        if (!MarkStep(deadline)) {
+            lock.unlock();
+            FinishMarking(false);
+            lock.lock();
+            break;
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        lock.unlock();
+        lock.lock();
+    }
+    while (SweepStep()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+    }
+    stepping_ = false;
+    return true;
+}
+
+// traces a bounded amount on every worker, returns false once no mark work is left
+bool GCImpl::MarkStep(std::chrono::steady_clock::time_point deadline) {
+    MarkRange(reinterpret_cast<uintptr_t>(satb_.data()),
+              reinterpret_cast<uintptr_t>(satb_.data() + satb_.size()), mark_workers_.front().get());
+    satb_.clear();
+    workers_.Run([this, deadline](size_t id) { MarkSome(id, kMarkStepRanges, deadline); });
+    return HasPendingMark();
+}
+
+// traces up to budget ranges, returns early once the worker finds no work or the deadline passed
+void GCImpl::MarkSome(size_t id, size_t budget, std::chrono::steady_clock::time_point deadline) {
+    MarkWorker* worker = mark_workers_[id].get();
+    MemoryRange range;
+    for (size_t done = 0; done < budget;) {
+        if (TakeMarkWork(id, workers_.Size(), &range)) {
+            MarkRange(Aligned(range.ptr), range.ptr + range.size, worker);
+            // a range may be a 64 KiB piece, so the clock is read every few of them
+            if (++done % kMarkClockRanges == 0 && std::chrono::steady_clock::now() >= deadline) {
+                return;
+            }
+        } else if (!worker->candidates.empty()) {
+            FlushMediumCandidates(worker);
+        } else {
+            return;
+        }
+    }
+}
+
+bool GCImpl::HasPendingMark() const {
+    if (!satb_.empty()) {
+        return true;
+    }
+    for (size_t id = 0; id < workers_.Size(); ++id) {
+        const MarkWorker& worker = *mark_workers_[id];
+        if (!worker.queue.empty() || worker.prefetch_count != 0 || !worker.candidates.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Traces everything left of a concurrent mark, logged pointers included. Runs in the remark
+// pause, and before memory is unmapped or given back to malloc while marking, as queued ranges
+// may point into it. Pointers still in the logs of thread caches are taken too, unless the
+// caller holds the cache locks and has flushed them
+void GCImpl::DrainMarking(bool caches_flushed) {
+    if (!caches_flushed) {
+        for (const auto& cache : thread_caches_) {
+            std::lock_guard<std::mutex> cache_lock(cache->lock);
+            satb_.insert(satb_.end(), cache->satb.begin(), cache->satb.end());
+            cache->satb.clear();
+        }
+    }
+    root_chunks_.clear();
+    next_root_chunk_.store(0);
+    AddMarkChunks(reinterpret_cast<uintptr_t>(satb_.data()), satb_.size() * sizeof(uintptr_t));
+    MarkParallel();
+    satb_.clear();
+}
+
+// page aligned ranges that hold objects, sorted and without overlaps
+void GCImpl::UpdateHeapSpans() {
+    std::vector<MemoryRange>& spans = heap_spans_;
+    spans.clear();
+    small_heap_.ForEachArena(
+        [&spans](uintptr_t start, size_t size) { spans.push_back(MemoryRange{start, size}); });
+    large_space_.ForEach([&spans](const LargeObject& object) {
+        spans.push_back(MemoryRange{object.ptr, object.mapped_size});
+    });
+    // medium objects live in malloc memory, the pages around them are tracked as well
+    allocations_.ForEach([&spans](const Allocation& alloc) {
+        uintptr_t start = alloc.ptr & ~(kPageSize - 1);
+        uintptr_t end = (alloc.ptr + alloc.size + kPageSize - 1) & ~(kPageSize - 1);
+        spans.push_back(MemoryRange{start, end - start});
+    });
+    std::sort(spans.begin(), spans.end(),
+              [](const MemoryRange& lhs, const MemoryRange& rhs) { return lhs.ptr < rhs.ptr; });
+    size_t merged = 0;
+    for (const MemoryRange& span : spans) {
+        if (merged != 0 && spans[merged - 1].ptr + spans[merged - 1].size >= span.ptr) {
+            MemoryRange& last = spans[merged - 1];
+            last.size = std::max(last.ptr + last.size, span.ptr + span.size) - last.ptr;
+        } else {
+            spans[merged++] = span;
+        }
+    }
+    spans.resize(merged);
+}
+
+// Remark of a mark that tracks written pages instead of logging overwritten pointers, as in
+// Boehm's mostly parallel collector. The roots and the parts of marked objects on pages written
+// since StartMarking are scanned again, DrainMarking traces what they point to
+void GCImpl::RescanDirty() {
+    AddRootChunks();
+    workers_.Run([this](size_t id) { MarkRoots(mark_workers_[id].get()); });
+    // lookups in the allocation table are not thread-safe, so one worker takes the pages
+    MarkWorker* worker = mark_workers_.front().get();
+    for (const MemoryRange& span : heap_spans_) {
+        dirty_pages_.ForEachDirty(span.ptr, span.size, [this, worker](uintptr_t start, uintptr_t end) {
+            for (uintptr_t card = start & ~(kCardSize - 1); card < end; card += kCardSize) {
+                ScanMarkedCard(card, worker);
+            }
+        });
+    }
+}
+
+// the old value of a slot is batched per thread and handed over once the batch fills
+void GCImpl::LogOverwritten(uintptr_t value) {
+    ThreadCache* cache = CurrentThreadCache();
+    if (cache != nullptr) {
+        std::unique_lock<std::mutex> cache_lock(cache->lock);
+        cache->satb.push_back(value);
+        if (cache->satb.size() < kSatbBufferSize) {
+            return;
+        }
+        std::vector<uintptr_t> logged;
+        logged.swap(cache->satb);
+        cache->satb.reserve(kSatbBufferSize);
+        // lock order is lock_collect_ before any thread cache
+        cache_lock.unlock();
+        std::lock_guard<std::mutex> lock(lock_collect_);
+        if (marking_) {
+            satb_.insert(satb_.end(), logged.begin(), logged.end());
+        }
+        return;
+    }
+    std::lock_guard<std::mutex> lock(lock_collect_);
+    if (marking_) {
+        satb_.push_back(value);
+    }
+}
+
+// an object freed or moved while marking runs loses its pointers like overwritten slots do,
+// lock_collect_ must be held
+void GCImpl::LogObject(uintptr_t ptr, size_t size) {
+    if (!marking_) {
+        return;
+    }
+    ScanRange(ptr, ptr + size, [this](uintptr_t word) { satb_.push_back(word); });
+}
+
+// Pages of the small heap and entries of the medium table are swept in chunks by the mark
+// workers, so finalizers may run on any of them. Large objects are few, they are swept by the
+// calling thread once the chunks are done
 void GCImpl::Sweep() {
-    auto non_valid =
-        std::stable_partition(allocated_memory_.begin(), allocated_memory_.end(),
-                              [this](const Allocation& alloc) { return IsValidAllocation(alloc); });
-    for (auto it = non_valid; it != allocated_memory_.end(); ++it) {
-        Allocation& alloc = *it;
-        alloc.finalizer(reinterpret_cast<void*>(alloc.ptr), alloc.size);
-        std::free(reinterpret_cast<void*>(alloc.ptr));
+    size_t num_small = small_heap_.PrepareSweep();
+    size_t num_chunks = num_small + allocations_.PrepareSweep();
+    bool defer = async_finalizers_;
+    deferred_.resize(std::max(deferred_.size(), workers_.Size()));
+    next_sweep_chunk_.store(0);
+    workers_.Run([this, num_small, num_chunks, defer](size_t id) {
+        std::vector<PendingFinalizer>* deferred = defer ? &deferred_[id] : nullptr;
+        size_t index;
+        while ((index = next_sweep_chunk_.fetch_add(1)) < num_chunks) {
+            if (index < num_small) {
+                small_heap_.SweepChunk(index, false, deferred);
+                continue;
+            }
+            allocations_.SweepChunk(index - num_small, [this, deferred](const Allocation& alloc) {
+                SweepMedium(alloc, deferred);
+            });
+        }
+    });
+    small_heap_.FinishSweep();
+    allocations_.FinishSweep();
+    large_space_.Sweep(defer ? &deferred_.front() : nullptr);
+}
+
+// Only the medium table is swept in the pause, as lookups must not see a half swept run, and
+// the dead entries it drops are kept for the sweeper. Everything else is swept by the sweeper
+// thread in steps under lock_collect_, mutators allocate from swept or fresh pages meanwhile
+void GCImpl::SweepInBackground(bool wake_sweeper) {
+    num_small_chunks_ = small_heap_.PrepareSweep();
+    next_small_chunk_ = 0;
+    large_space_.PrepareSweep();
+    size_t num_chunks = allocations_.PrepareSweep();
+    dead_medium_.resize(workers_.Size());
+    next_sweep_chunk_.store(0);
+    workers_.Run([this, num_chunks](size_t id) {
+        size_t index;
+        while ((index = next_sweep_chunk_.fetch_add(1)) < num_chunks) {
+            allocations_.SweepChunk(
+                index, [this, id](const Allocation& alloc) { dead_medium_[id].push_back(alloc); });
+        }
+    });
+    allocations_.FinishSweep();
+    sweep_pending_ = true;
+    if (!wake_sweeper) {
+        return;
+    }
+    if (!sweeper_.joinable()) {
+        sweeper_ = std::thread(&GCImpl::SweeperLoop, this);
+    }
+    sweeper_wake_.notify_one();
+}
+
+// sweeps one chunk of the pending background sweep, returns false once nothing is left.
+// lock_collect_ must be held
+bool GCImpl::SweepStep() {
+    if (!sweep_pending_) {
+        return false;
+    }
+    std::vector<PendingFinalizer> finalizable;
+    std::vector<PendingFinalizer>* deferred = async_finalizers_ ? &finalizable : nullptr;
+    if (next_small_chunk_ < num_small_chunks_) {
+        small_heap_.SweepChunk(next_small_chunk_++, true, deferred);
+        finalizers_.Push(&finalizable);
+        return true;
+    }
+    for (auto& dead : dead_medium_) {
+        if (!dead.empty()) {
+            size_t count = std::min(dead.size(), kSweepChunkEntries);
+            for (size_t i = dead.size() - count; i < dead.size(); ++i) {
+                SweepMedium(dead[i], deferred);
+            }
+            dead.resize(dead.size() - count);
+            finalizers_.Push(&finalizable);
+            return true;
+        }
     }
-    allocated_memory_.erase(non_valid, allocated_memory_.end());
-    last_size_ = allocated_memory_.size();
+    large_space_.SweepPrepared(deferred);
+    finalizers_.Push(&finalizable);
+    sweep_pending_ = false;
+    return false;
 }
 
-void GCImpl::Collect() {
-    StopWorld();
+// lock_collect_ must be held
+void GCImpl::FinishSweep() {
+    while (SweepStep()) {
+    }
+}
+
+void GCImpl::SweeperLoop() {
     std::unique_lock<std::mutex> lock(lock_collect_);
-    CollectPrepare();
-    MarkHeapAllocs(MarkRoots());
-    Sweep();
-    lock.unlock();
+    while (true) {
+        sweeper_wake_.wait(lock, [this] { return stop_sweeper_ || sweep_pending_; });
+        if (stop_sweeper_) {
+            return;
+        }
+        while (SweepStep()) {
+            // mutators waiting for the lock get in between steps
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+    }
+}
+
+void GCImpl::StopSweeper() {
+    {
+        std::lock_guard<std::mutex> lock(lock_collect_);
+        stop_sweeper_ = true;
+    }
+    sweeper_wake_.notify_all();
+    if (sweeper_.joinable()) {
+        sweeper_.join();
+    }
+}
+
+void GCImpl::FreeMedium(const Allocation& alloc) {
+    alloc.finalizer(reinterpret_cast<void*>(alloc.ptr), alloc.size);
+    page_map_.RemoveMedium(alloc.ptr, alloc.size);
+    std::free(reinterpret_cast<void*>(alloc.ptr));
+}
+
+// objects with a real finalizer are left for the finalizer executor when deferred is set
+void GCImpl::SweepMedium(const Allocation& alloc, std::vector<PendingFinalizer>* deferred) {
+    if (deferred != nullptr && IsFinalizable(alloc.finalizer)) {
+        deferred->push_back(PendingFinalizer{alloc.ptr, alloc.size, alloc.finalizer});
+        return;
+    }
+    FreeMedium(alloc);
+}
+
+// frees objects whose deferred finalizers have run, lock_collect_ must be held
+void GCImpl::ReleaseFinalized(const std::vector<PendingFinalizer>& objects) {
+    for (const PendingFinalizer& object : objects) {
+        if (PageHeader* page = small_heap_.FindPage(object.ptr)) {
+            small_heap_.Release(page, (object.ptr - page->start) / page->object_size);
+        } else if (LargeObject* large = large_space_.Find(object.ptr)) {
+            // a stale pointer may have got it marked and queued
+            if (marking_) {
+                DrainMarking();
+            }
+            large_space_.Free(large);
+        } else {
+            page_map_.RemoveMedium(object.ptr, object.size);
+            std::free(reinterpret_cast<void*>(object.ptr));
+        }
+    }
+}
+
+void GCImpl::RecordPause(CollectionKind kind, uint64_t pause_ns) {
+    if (kind == CollectionKind::kMinor) {
+        ++stats_.minor_collections;
+        stats_.last_minor_pause_ns = pause_ns;
+        stats_.total_minor_pause_ns += pause_ns;
+    } else {
+        ++stats_.full_collections;
+        stats_.last_full_pause_ns = pause_ns;
+        stats_.total_full_pause_ns += pause_ns;
+    }
+}
+
+void GCImpl::Collect(CollectionKind kind) {
+    std::lock_guard<std::mutex> cycle(lock_cycle_);
+    // a cycle driven by Step is finished first
+    if (marking_ || (kind == CollectionKind::kFull && (concurrent_mark_ || dirty_page_mark_))) {
+        CollectConcurrent();
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    // threads that were never registered, or were dropped by DisableScheduler, don't stop at
+    // safepoints, so their caches stay locked until the end of collection
+    std::unique_lock<std::mutex> lock(lock_collect_, std::defer_lock);
+    auto cache_locks = StopWorld(&lock);
+    GCWorkerPool::CallerAffinity pinned(workers_);
+    // the last collection's sweep may still run, marks must not change under it
+    FinishSweep();
+    CollectPrepare(kind);
+    PrepareMarkWorkers();
+    ReserveRootChunks(0);
+    SuspendWorld();
+    if (kind == CollectionKind::kMinor) {
+        MarkDirtyCards(mark_workers_.front().get());
+    }
+    AddRootChunks();
+    MarkParallel();
+    // every survivor is old now, so no old object points to a young one
+    card_table_.Clear();
+    // the marks are final, threads that need the collector wait for the locks
     ResumeWorld();
+    if (background_sweep_) {
+        SweepInBackground(true);
+    } else {
+        Sweep();
+    }
+    cache_locks.clear();
+    RecordPause(kind, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count());
+    std::vector<PendingFinalizer> finalizable;
+    for (auto& deferred : deferred_) {
+        finalizable.insert(finalizable.end(), deferred.begin(), deferred.end());
+        deferred.clear();
+    }
+    lock.unlock();
+    finalizers_.Push(&finalizable);
+}
+
+GCStats GCImpl::GetStats() {
+    std::lock_guard<std::mutex> lock(lock_collect_);
+    return stats_;
 }
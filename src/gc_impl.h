@@ -2,21 +2,81 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <thread>
-#include <unordered_set>
+#include <unordered_map>
 #include <vector>
 #include "gc_fwd.h"
 #include "gc.h"
+#include "gc_allocation_table.h"
+#include "gc_card_table.h"
+#include "gc_dirty_pages.h"
+#include "gc_finalizer.h"
+#include "gc_heap.h"
+#include "gc_large_space.h"
+#include "gc_page_map.h"
+#include "gc_poll_page.h"
+#include "gc_root_registry.h"
+#include "gc_scan.h"
 #include "gc_scheduler.h"
+#include "gc_thread_stack.h"
+#include "gc_worker_pool.h"
+#include "stealing_queue.h"
 
-struct Allocation {
+// Memory range that the mark phase scans for pointers
+struct MemoryRange {
     uintptr_t ptr;
     size_t size;
-    FinalizerT finalizer;
-    size_t last_valid_time;
+};
+
+constexpr size_t kAllocationLogSize = 256;
+constexpr size_t kStatsFlushCalls = 64;
+constexpr size_t kMarkBatchSize = 4096;  // medium candidates looked up at once
+constexpr size_t kMarkChunkSize = 64 * 1024;  // bigger objects are split between mark workers
+constexpr size_t kMaxMarkWorkers = 64;
+constexpr size_t kMarkPrefetchDepth = 8;  // popped objects in flight before one is scanned
+constexpr size_t kMarkPrefetchBytes = 256;  // prefix of an object prefetched before scanning
+constexpr size_t kCacheLineSize = 64;
+constexpr size_t kMarkStepRanges = 1024;  // ranges a worker traces per concurrent mark step
+constexpr size_t kMarkClockRanges = 8;     // ranges traced between two deadline checks
+constexpr size_t kSatbBufferSize = 256;  // pointers a thread logs before handing them over
+constexpr uint32_t kStopRequested = 1u << 31;  // in world_, the rest counts stopped threads
+
+// Allocation state private to a registered thread. Small objects are taken from pages the thread
+// owns and bigger ones are appended to a log, which is merged into the allocation table at
+// CollectPrepare or when it fills. The lock is only contended by a running collection.
+struct ThreadCache {
+    GCImpl* gc = nullptr;
+    std::mutex lock;
+    PageHeader* pages[kNumPageKinds][kNumSizeClasses] = {};
+    std::vector<Allocation> log;
+    std::vector<uintptr_t> satb;  // pointers overwritten while marking runs concurrently
+    size_t pending_bytes = 0;
+    size_t pending_calls = 0;
+    ThreadStack stack;  // scanned as a root when threads are stopped with signals
+    bool blocking = false;  // counted in world_ by EnterBlocking, guarded by threads_registering_
+};
+
+// State of one mark thread. Objects it marks go to its own queue, idle workers steal from there
+struct MarkWorker {
+    // a pause of a stop with signals must not grow the batches
+    MarkWorker() {
+        candidates.reserve(kMarkBatchSize);
+        scratch.reserve(kMarkBatchSize);
+    }
+
+    WorkStealingQueue<MemoryRange> queue;
+    // ring of popped ranges whose first cache lines are being prefetched, not visible to thieves
+    MemoryRange prefetched[kMarkPrefetchDepth];
+    size_t prefetch_head = 0;
+    size_t prefetch_count = 0;
+    std::vector<uintptr_t> candidates;  // pointers waiting for a batched lookup
+    std::vector<uintptr_t> scratch;
 };
 
 constexpr int kAlignment = alignof(void**);
@@ -33,13 +93,20 @@ public:
     void Init(const std::vector<Allocation>& roots);
     void AddRoot(const Allocation& root);
     void DeleteRoot(const Allocation& root);
+    // O(1) and without lock_collect_, unregistering waits only while a collection scans the roots
+    GCRootEntry* RegisterRoot(uintptr_t ptr, size_t size, bool hinted);
+    void UnregisterRoot(GCRootEntry* root);
+    void RootChanged(GCRootEntry* root);
 
     // Memory allocation functions
-    void* Malloc(size_t size, FinalizerT finalizer);
+    // objects with a layout are scanned by it, nullptr scans the whole object
+    void* Malloc(size_t size, FinalizerT finalizer, const GCLayout* layout = nullptr);
     void* Calloc(size_t nmemb, size_t size, FinalizerT finalizer);
     void* Realloc(void* ptr, size_t size, FinalizerT finalizer);
     void Free(uintptr_t ptr);
     void FreeAll();
+    // the layout lives as long as the collector, nullptr if num_words is 0
+    const GCLayout* MakeLayout(const uint64_t* bitmap, size_t num_words);
 
     // Automatic memory management
     GCScheduler& GetScheduler();
@@ -48,76 +115,214 @@ public:
     void EnableScheduler();
 
     // Thread safety
-    void Safepoint();
+    void Safepoint() {
+        // a load from the poll page, it faults while a stop is in progress
+        if (poll_page_.Poll()) {
+            Park();
+        }
+    }
     void RegisterThread();
     void DeregisterThread();
+    // the thread counts as stopped in between, LeaveBlocking waits while the world is stopped
+    void EnterBlocking();
+    void LeaveBlocking();
+
+    // Generational mode
+    void SetGenerational(bool enable);
+    bool IsGenerational() const;
+
+    // Background sweeping, the world is resumed right after marking and a sweeper thread
+    // finalizes and frees the dead objects while mutators run
+    void SetBackgroundSweep(bool enable);
+    // returns once the sweep of the last collection is done, helping with what is left
+    void WaitSweep();
+
+    // Asynchronous finalization, dead objects with finalizers are queued by the sweep and
+    // finalized by an executor thread in batches after the world resumes
+    void SetAsyncFinalizers(bool enable);
+    FinalizerExecutor& GetFinalizerExecutor();
+
+    // Concurrent marking, full collections trace the heap while mutators run between a short
+    // pause that scans the roots and a short remark pause. Mutators must call WriteBarrierPre
+    // before overwriting a pointer in the heap meanwhile, objects allocated then are marked
+    void SetConcurrentMark(bool enable);
+    // snapshot-at-the-beginning barrier, the old value of the slot is kept alive
+    void WriteBarrierPre(uintptr_t slot) {
+        // flips only while the world is stopped
+        if (marking_.load(std::memory_order_relaxed)) {
+            uintptr_t old = *reinterpret_cast<const uintptr_t*>(slot);
+            if (old != 0) {
+                LogOverwritten(old);
+            }
+        }
+    }
+
+    // Concurrent marking without a write barrier, the kernel tracks the pages mutators write
+    // while marking runs and the remark pause scans the roots and those pages again. Returns
+    // false if the kernel tracks neither soft-dirty bits nor write protected pages
+    bool SetDirtyPageMark(bool enable);
+
+    // Stacks and registers of registered threads are roots, threads are stopped with signals
+    // instead of waiting at safepoints. Returns false if the signals can't be installed
+    bool SetStackRoots(bool enable);
+
+    // collector threads, the count includes the thread running the collection
+    void SetWorkerThreads(size_t count);
+    size_t GetWorkerThreads();
+    void SetWorkerAffinity(const std::vector<int>& cpus);
+    void WriteBarrier(uintptr_t slot) {
+        card_table_.Dirty(slot);
+    }
 
     // Collect
-    void Collect();
+    void Collect(CollectionKind kind = CollectionKind::kFull);
+    // does about budget of incremental collection work, returns true once the cycle is complete
+    bool Step(std::chrono::nanoseconds budget);
+    GCStats GetStats();
 
 private:
     // Allocations helpers
-    void CreateAllocation(uintptr_t ptr, size_t size, FinalizerT finalizer);
-    void DeleteAllocation(uintptr_t ptr);
-    bool IsValidAllocation(const Allocation& alloc);
-    void SortAllocations();
+    void* AllocateSmall(size_t size, FinalizerT finalizer, const GCLayout* layout = nullptr);
+    void* AllocateLarge(size_t size, FinalizerT finalizer, const GCLayout* layout = nullptr);
+    void* AllocateLocked(size_t size, FinalizerT finalizer);
+    void NoteAllocation(size_t size);
+    void MarkAllocated(uintptr_t ptr);
+    void NoteCachedAllocation(ThreadCache* cache, size_t size);
+    void CreateAllocation(uintptr_t ptr, size_t size, FinalizerT finalizer,
+                          const GCLayout* layout = nullptr);
+    void InsertAllocation(const Allocation& alloc);
+    bool FindAllocation(uintptr_t ptr, Allocation* alloc);
+    bool TakeAllocation(uintptr_t ptr, Allocation* alloc);
+
+    // Thread caches, lock_collect_ must be held
+    ThreadCache* CurrentThreadCache();
+    void FlushThreadCache(ThreadCache* cache);
+    void MergeAllocationLog(ThreadCache* cache);
+    void MergeAllocationLogs();
+    std::vector<std::unique_lock<std::mutex>> LockThreadCaches();
 
     // Mark Sweep part
-    void StopWorld();
+    // leaves lock held and returns the locks of the thread caches
+    std::vector<std::unique_lock<std::mutex>> StopWorld(std::unique_lock<std::mutex>* lock);
+    void SuspendWorld();
     void ResumeWorld();
-    void CollectPrepare();
-    std::vector<Allocation*> MarkRoots();
-    void MarkHeapAllocs(const std::vector<Allocation*>& live_allocs);
+    void RecordTimeToSafepoint();
+    void Park();
+    void LeaveStopped();
+    void NotifyStopEvent();
+    void CollectPrepare(CollectionKind kind);
+    bool MarkEntry(PageMapEntry entry, uintptr_t ptr, MemoryRange* object,
+                   const GCLayout** layout);
+    void MarkRange(uintptr_t start, uintptr_t end, MarkWorker* worker);
+    void FlushMediumCandidates(MarkWorker* worker);
+    void PushMarked(MarkWorker* worker, MemoryRange object, const GCLayout* layout);
+    void PushRange(MarkWorker* worker, MemoryRange range);
+    // calls visit for the words of [start, end) that may point into the heap
+    template <typename Visitor>
+    void ScanRange(uintptr_t start, uintptr_t end, Visitor visit) const {
+        ScanWords(start, end, page_map_.MinAddress(), page_map_.MaxAddress(), visit);
+    }
+    void AddMarkChunks(uintptr_t start, size_t size);
+    void AddRootChunks();
+    void ReserveRootChunks(size_t extra_bytes);
+    void MarkRoots(MarkWorker* worker);
+    void AddRegisteredRoot(GCRootEntry* root);
+    void ReleaseRoots(const std::vector<GCRootEntry*>& roots);
+    void MarkDirtyCards(MarkWorker* worker);
+    void ScanMarkedCard(uintptr_t card, MarkWorker* worker);
+    void ScanCard(uintptr_t card, uintptr_t start, uintptr_t end, const GCLayout* layout,
+                  MarkWorker* worker);
+    size_t NumWorkers() const;
+    void PrepareMarkWorkers();
     void MarkParallel();
+    void MarkLoop(size_t id, size_t num_workers);
+    bool TakeMarkWork(size_t id, size_t num_workers, MemoryRange* range);
+    bool StealMarkWork(size_t id, size_t num_workers, MemoryRange* range);
+    bool HasMarkWork(size_t id, size_t num_workers) const;
+    // concurrent marking, lock_collect_ must be held
+    void CollectConcurrent();
+    void StartMarking();
+    void FinishMarking(bool wake_sweeper);
+    bool MarkStep(std::chrono::steady_clock::time_point deadline =
+                      std::chrono::steady_clock::time_point::max());
+    void MarkSome(size_t id, size_t budget, std::chrono::steady_clock::time_point deadline);
+    bool HasPendingMark() const;
+    void DrainMarking(bool caches_flushed = false);
+    void LogOverwritten(uintptr_t value);
+    void LogObject(uintptr_t ptr, size_t size);
+    void UpdateHeapSpans();
+    void RescanDirty();
     void Sweep();
+    void SweepInBackground(bool wake_sweeper);
+    bool SweepStep();
+    void FinishSweep();
+    void SweeperLoop();
+    void StopSweeper();
+    void FreeMedium(const Allocation& alloc);
+    void SweepMedium(const Allocation& alloc, std::vector<PendingFinalizer>* deferred);
+    void ReleaseFinalized(const std::vector<PendingFinalizer>& objects);
+    void RecordPause(CollectionKind kind, uint64_t pause_ns);
 
-    // template Find allocation
-    template <bool IsFast>
-    Allocation* FindAllocation(uintptr_t ptr) {
-        if (ptr < allocated_memory_[0].ptr) {
-            return nullptr;
-        }
-        Allocation fake{ptr, 0, nullptr, 0};
-
-        std::vector<Allocation>::iterator begin_search = allocated_memory_.begin(),
-                                          end_search = allocated_memory_.end();
-        if (prev_find_ != allocated_memory_.end() && prev_find_.base() != nullptr) {
-            if (prev_find_->ptr <= ptr) {
-                begin_search = prev_find_;
-            } else {
-                end_search = prev_find_;
-            }
-        }
-        auto it = std::upper_bound(
-            begin_search, end_search, fake,
-            [](const Allocation& lhs, const Allocation& rhs) { return lhs.ptr < rhs.ptr; });
-        if (it == allocated_memory_.begin()) {
-            if constexpr (IsFast) {
-                prev_find_ = allocated_memory_.end();
-            }
-            return nullptr;
-        }
-        --it;
-        prev_find_ = it;
-        Allocation& alloc = *it;
-        if (ptr < alloc.ptr + alloc.size) {
-            return &alloc;
-        }
-        return nullptr;
-    }
-
-    std::vector<Allocation> allocated_memory_;
-    std::vector<Allocation>::iterator prev_find_;  // for fast find alloc, like cached value
-    size_t last_size_ = 0;
-    size_t timer_;
-    std::vector<Allocation> roots_;
+    CardTable card_table_;
+    PageMap page_map_;
+    SmallObjectHeap small_heap_;
+    LargeObjectSpace large_space_;
+    AllocationTable allocations_;  // objects between small and large sizes
+    GCWorkerPool workers_;
+    size_t worker_threads_ = 0;  // 0 is one per core
+    std::vector<std::unique_ptr<MarkWorker>> mark_workers_;  // kept between collections
+    std::atomic<size_t> active_markers_ = 0;
+    std::vector<MemoryRange> root_chunks_;
+    std::atomic<size_t> next_root_chunk_ = 0;
+    // 1 from AddRootChunks until the last mark worker is done with the root chunks, unlinked
+    // roots are released only when it is 0 again
+    std::atomic<uint32_t> root_scan_ = 0;
+    std::atomic<size_t> root_scanners_ = 0;
+    std::vector<MemoryRange> heap_spans_;  // for the dirty page mark, see UpdateHeapSpans
+    std::vector<uintptr_t> satb_;  // overwritten pointers handed over by mutators
+    DirtyPageTracker dirty_pages_;
+    std::atomic<size_t> next_sweep_chunk_ = 0;
+    // state of the background sweep, guarded by lock_collect_
+    std::thread sweeper_;
+    std::condition_variable sweeper_wake_;
+    bool sweep_pending_ = false;
+    bool stop_sweeper_ = false;
+    size_t num_small_chunks_ = 0;
+    size_t next_small_chunk_ = 0;
+    std::vector<std::vector<Allocation>> dead_medium_;  // per sweep worker
+    std::vector<std::vector<PendingFinalizer>> deferred_;  // per sweep worker
+    FinalizerExecutor finalizers_;
+    RootRegistry roots_;
+    std::vector<std::unique_ptr<GCLayout>> layouts_;  // guarded by lock_collect_
     GCScheduler scheduler_;
-    bool enable_auto_ = true;
+    std::atomic<bool> enable_auto_ = true;
+    std::atomic<bool> generational_ = false;
+    std::atomic<bool> background_sweep_ = false;
+    std::atomic<bool> async_finalizers_ = false;
+    std::atomic<bool> concurrent_mark_ = false;
+    std::atomic<bool> dirty_page_mark_ = false;
+    std::atomic<bool> stack_roots_ = false;
+    std::atomic<bool> marking_ = false;  // a concurrent mark is between its two pauses
+    bool rescan_dirty_ = false;  // the running mark tracks written pages, guarded by lock_collect_
+    std::chrono::steady_clock::duration mark_pause_{};  // both pauses of the concurrent mark
+    bool stepping_ = false;  // a cycle started by Step is not complete, guarded by lock_cycle_
+    // the world is stopped with signals, guarded by lock_cycle_
+    bool signal_stop_ = false;
+    std::vector<ThreadStack*> suspended_;
+    std::chrono::steady_clock::time_point stop_start_;
+    GCStats stats_ = {};
+    std::vector<std::unique_ptr<ThreadCache>> thread_caches_;
 
-    std::atomic<bool> should_stop_ = false;
-    std::atomic<size_t> stopped_ = 0;
+    // Stop handshake: kStopRequested and the number of threads at a safepoint or in a blocking
+    // region. Both waits are eventcounts on futexes, StopWorld sleeps on stop_events_ which
+    // changes when a thread stops or deregisters, stopped threads on resumes_
+    std::atomic<uint32_t> world_ = 0;
+    std::atomic<uint32_t> stop_events_ = 0;
+    std::atomic<uint32_t> resumes_ = 0;
+    PollPage poll_page_;
     std::mutex lock_collect_, threads_registering_;
-    std::condition_variable stopping_thread_;
-    std::unordered_set<std::thread::id> threads_;
+    std::mutex lock_cycle_;  // held by the thread that drives a collection
+    // threads a stop waits for, only they count in world_ while blocking
+    std::unordered_map<std::thread::id, ThreadCache*> threads_;
     std::atomic<size_t> threads_count_;
 };
@@ -0,0 +1,158 @@
+#include "gc_large_space.h"
+#include <sys/mman.h>
+#include <algorithm>
+
+static size_t RoundToPages(size_t size) {
+    return (size + kPageSize - 1) & ~(kPageSize - 1);
+}
+
+LargeObjectSpace::LargeObjectSpace(PageMap* page_map) : page_map_(page_map) {
+}
+
+LargeObjectSpace::~LargeObjectSpace() {
+    ReleaseAll();
+}
+
+void* LargeObjectSpace::Allocate(size_t size, FinalizerT finalizer, const GCLayout* layout) {
+    size_t mapped_size = RoundToPages(size);
+    void* mem = Map(mapped_size);
+    if (mem == nullptr) {
+        return nullptr;
+    }
+    Insert(std::make_unique<LargeObject>(
+        LargeObject{reinterpret_cast<uintptr_t>(mem), size, mapped_size, finalizer, false, 0,
+                    sweep_epoch_, false, layout}));
+    return mem;
+}
+
+void* LargeObjectSpace::Reallocate(LargeObject* object, size_t size, FinalizerT finalizer) {
+    size_t mapped_size = RoundToPages(size);
+    void* mem = mremap(reinterpret_cast<void*>(object->ptr), object->mapped_size, mapped_size,
+                       MREMAP_MAYMOVE);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+    page_map_->Clear(object->ptr, object->mapped_size);
+    object->ptr = reinterpret_cast<uintptr_t>(mem);
+    object->size = size;
+    object->mapped_size = mapped_size;
+    object->finalizer = finalizer;
+    object->layout = nullptr;
+    object->marked = false;
+    object->swept_epoch = sweep_epoch_;
+    page_map_->Set(object->ptr, object->mapped_size, PageMapEntry::Large(object));
+    return mem;
+}
+
+void LargeObjectSpace::Free(LargeObject* object) {
+    Unmap(object->ptr, object->mapped_size);
+    Erase(object);
+}
+
+void LargeObjectSpace::ReleaseAll() {
+    for (const auto& object : objects_) {
+        page_map_->Clear(object->ptr, object->mapped_size);
+        munmap(reinterpret_cast<void*>(object->ptr), object->mapped_size);
+    }
+    for (const Mapping& mapping : cached_) {
+        munmap(reinterpret_cast<void*>(mapping.ptr), mapping.size);
+    }
+    objects_.clear();
+    cached_.clear();
+    cached_bytes_ = 0;
+}
+
+void* LargeObjectSpace::Map(size_t mapped_size) {
+    // smallest cached mapping that fits without wasting more than half of it
+    auto best = cached_.end();
+    for (auto it = cached_.begin(); it != cached_.end(); ++it) {
+        if (it->size >= mapped_size && it->size / 2 <= mapped_size &&
+            (best == cached_.end() || it->size < best->size)) {
+            best = it;
+        }
+    }
+    if (best != cached_.end()) {
+        uintptr_t ptr = best->ptr;
+        size_t size = best->size;
+        cached_bytes_ -= size;
+        cached_.erase(best);
+        if (size > mapped_size) {
+            munmap(reinterpret_cast<void*>(ptr + mapped_size), size - mapped_size);
+        }
+        return reinterpret_cast<void*>(ptr);
+    }
+    void* mem = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+    return mem == MAP_FAILED ? nullptr : mem;
+}
+
+void LargeObjectSpace::Unmap(uintptr_t ptr, size_t mapped_size) {
+    page_map_->Clear(ptr, mapped_size);
+    if (cached_.size() < kMaxCachedMappings && cached_bytes_ + mapped_size <= kMaxCachedBytes) {
+        // pages go back to the OS right away, reusing the range saves the mmap and VMA churn
+        madvise(reinterpret_cast<void*>(ptr), mapped_size, MADV_DONTNEED);
+        cached_.push_back(Mapping{ptr, mapped_size});
+        cached_bytes_ += mapped_size;
+        return;
+    }
+    munmap(reinterpret_cast<void*>(ptr), mapped_size);
+}
+
+void LargeObjectSpace::Insert(std::unique_ptr<LargeObject> object) {
+    object->index = objects_.size();
+    page_map_->Set(object->ptr, object->mapped_size, PageMapEntry::Large(object.get()));
+    objects_.push_back(std::move(object));
+}
+
+void LargeObjectSpace::Erase(LargeObject* object) {
+    size_t index = object->index;
+    if (index + 1 != objects_.size()) {
+        objects_[index] = std::move(objects_.back());
+        objects_[index]->index = index;
+    }
+    objects_.pop_back();
+}
+
+void LargeObjectSpace::ClearMarks() {
+    for (const auto& object : objects_) {
+        object->marked = false;
+    }
+}
+
+size_t LargeObjectSpace::Sweep(std::vector<PendingFinalizer>* deferred) {
+    PrepareSweep();
+    return SweepPrepared(deferred);
+}
+
+void LargeObjectSpace::PrepareSweep() {
+    ++sweep_epoch_;
+}
+
+size_t LargeObjectSpace::SweepPrepared(std::vector<PendingFinalizer>* deferred) {
+    size_t freed_bytes = 0;
+    size_t live = 0;
+    for (size_t i = 0; i < objects_.size(); ++i) {
+        std::unique_ptr<LargeObject>& object = objects_[i];
+        if (!object->marked && !object->finalizing && object->swept_epoch != sweep_epoch_ &&
+            deferred != nullptr && IsFinalizable(object->finalizer)) {
+            deferred->push_back(PendingFinalizer{object->ptr, object->size, object->finalizer});
+            object->finalizing = true;
+        }
+        if (object->marked || object->finalizing || object->swept_epoch == sweep_epoch_) {
+            object->index = live;
+            if (live != i) {
+                objects_[live] = std::move(object);
+            }
+            ++live;
+            continue;
+        }
+        if (object->finalizer != nullptr) {
+            object->finalizer(reinterpret_cast<void*>(object->ptr), object->size);
+        }
+        Unmap(object->ptr, object->mapped_size);
+        freed_bytes += object->mapped_size;
+        object.reset();
+    }
+    objects_.resize(live);
+    return freed_bytes;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "gc.h"
+#include "gc_heap.h"
+#include "gc_page_map.h"
+
+constexpr size_t kLargeObjectSize = 128 * 1024;
+// freed mappings kept for reuse after their pages were given back with MADV_DONTNEED
+constexpr size_t kMaxCachedMappings = 32;
+constexpr size_t kMaxCachedBytes = size_t{1} << 30;  // address space only
+
+inline bool IsLargeSize(size_t size) {
+    return size >= kLargeObjectSize;
+}
+
+struct LargeObject {
+    uintptr_t ptr;
+    size_t size;
+    size_t mapped_size;  // whole pages
+    FinalizerT finalizer;
+    bool marked;
+    size_t index;  // position in LargeObjectSpace::objects_
+    uint64_t swept_epoch;  // objects allocated after PrepareSweep are left alone by Sweep
+    bool finalizing;       // dead, mapped until its deferred finalizer has run
+    const GCLayout* layout;  // nullptr is scanned conservatively
+
+    // returns true if the object was not marked before
+    bool TestAndMark() {
+        std::atomic_ref<bool> flag(marked);
+        return !flag.load(std::memory_order_relaxed) &&
+               !flag.exchange(true, std::memory_order_relaxed);
+    }
+};
+
+// Every large object gets its own mapping, so sweeping it returns memory to the OS at once.
+// Pages of an object point to it in the page map. Not thread-safe, callers serialize access.
+class LargeObjectSpace {
+public:
+    explicit LargeObjectSpace(PageMap* page_map);
+    LargeObjectSpace(const LargeObjectSpace&) = delete;
+    LargeObjectSpace& operator=(const LargeObjectSpace&) = delete;
+    ~LargeObjectSpace();
+
+    // memory is zeroed, nullptr when the OS refuses to map it
+    void* Allocate(size_t size, FinalizerT finalizer, const GCLayout* layout = nullptr);
+    // grows or shrinks the mapping in place when possible, nullptr on failure. The object is
+    // scanned conservatively afterwards
+    void* Reallocate(LargeObject* object, size_t size, FinalizerT finalizer);
+    // unmaps the object without calling the finalizer
+    void Free(LargeObject* object);
+    void ReleaseAll();
+
+    LargeObject* Find(uintptr_t ptr) const {
+        return Find(page_map_->Get(ptr), ptr);
+    }
+
+    static LargeObject* Find(PageMapEntry entry, uintptr_t ptr) {
+        LargeObject* object = entry.AsLarge();
+        return object != nullptr && ptr < object->ptr + object->size ? object : nullptr;
+    }
+
+    void ClearMarks();
+    template <typename Visitor>
+    void ForEach(Visitor visit) const {
+        for (const auto& object : objects_) {
+            visit(*object);
+        }
+    }
+    // Finalizes and unmaps all objects without mark, returns number of freed bytes. With
+    // deferred set, dead objects with finalizers are appended to it instead and stay mapped
+    // until Free
+    size_t Sweep(std::vector<PendingFinalizer>* deferred = nullptr);
+    // Sweep split in two for sweeping while the space is in use. Objects allocated or
+    // reallocated after PrepareSweep survive SweepPrepared even though they are not marked
+    void PrepareSweep();
+    size_t SweepPrepared(std::vector<PendingFinalizer>* deferred = nullptr);
+
+private:
+    struct Mapping {
+        uintptr_t ptr;
+        size_t size;
+    };
+
+    void* Map(size_t mapped_size);
+    void Unmap(uintptr_t ptr, size_t mapped_size);
+    void Insert(std::unique_ptr<LargeObject> object);
+    void Erase(LargeObject* object);
+
+    PageMap* page_map_;
+    std::vector<std::unique_ptr<LargeObject>> objects_;
+    std::vector<Mapping> cached_;
+    size_t cached_bytes_ = 0;
+    uint64_t sweep_epoch_ = 0;
+};
@@ -0,0 +1,20 @@
+#include "gc_layout.h"
+
+const GCLayout kPointerFreeLayout;
+
+GCLayout MakeLayout(const uint64_t* bitmap, size_t num_words) {
+    GCLayout layout;
+    layout.period = num_words * kLayoutWord;
+    for (size_t word = 0; word < num_words; ++word) {
+        if (!((bitmap[word / 64] >> (word % 64)) & 1)) {
+            continue;
+        }
+        if (!layout.runs.empty() &&
+            layout.runs.back().first + layout.runs.back().count == word) {
+            ++layout.runs.back().count;
+        } else {
+            layout.runs.push_back(PointerRun{static_cast<uint32_t>(word), 1});
+        }
+    }
+    return layout;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "gc.h"
+
+constexpr size_t kLayoutWord = sizeof(uintptr_t);
+
+// words [first, first + count) of a layout period may hold pointers
+struct PointerRun {
+    uint32_t first;
+    uint32_t count;
+};
+
+// Where the pointers of a typed object are, as runs of words within a period that repeats over
+// the whole object, so an array of a struct shares the layout of the struct. A layout without
+// runs is pointer-free, its objects are never scanned
+struct GCLayout {
+    size_t period = kLayoutWord;  // bytes
+    std::vector<PointerRun> runs;
+
+    bool IsPointerFree() const {
+        return runs.empty();
+    }
+
+    // calls visit(start, end) for the parts of [lo, hi) that may hold pointers, in address
+    // order, for the object at object
+    template <typename Visitor>
+    void ForEachRun(uintptr_t object, uintptr_t lo, uintptr_t hi, Visitor visit) const {
+        if (runs.empty() || lo >= hi) {
+            return;
+        }
+        for (uintptr_t base = object + (lo - object) / period * period; base < hi;
+             base += period) {
+            for (const PointerRun& run : runs) {
+                uintptr_t start = std::max(lo, base + run.first * kLayoutWord);
+                uintptr_t end = std::min(hi, base + (run.first + run.count) * kLayoutWord);
+                if (start < end) {
+                    visit(start, end);
+                }
+            }
+        }
+    }
+};
+
+// layout of objects from gc_malloc_atomic
+extern const GCLayout kPointerFreeLayout;
+
+// bit i % 64 of bitmap[i / 64] is set if word i may hold a pointer
+GCLayout MakeLayout(const uint64_t* bitmap, size_t num_words);
@@ -0,0 +1,75 @@
+#include "gc_page_map.h"
+#include <sys/mman.h>
+#include <algorithm>
+#include <new>
+
+PageMap::PageMap() : root_(std::make_unique<std::atomic<Leaf*>[]>(kPageMapRootSize)) {
+}
+
+PageMap::~PageMap() {
+    for (Leaf* leaf : leaves_) {
+        munmap(leaf, sizeof(Leaf));
+    }
+}
+
+PageMap::Leaf* PageMap::LeafFor(size_t page) {
+    size_t root = page >> kPageMapLeafShift;
+    if (root >= kPageMapRootSize) {
+        throw std::bad_alloc{};
+    }
+    Leaf* leaf = root_[root].load(std::memory_order_relaxed);
+    if (leaf != nullptr) {
+        return leaf;
+    }
+    // untouched parts of the leaf stay unbacked
+    void* mem = mmap(nullptr, sizeof(Leaf), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        throw std::bad_alloc{};
+    }
+    leaf = static_cast<Leaf*>(mem);
+    leaves_.push_back(leaf);
+    root_[root].store(leaf, std::memory_order_release);
+    return leaf;
+}
+
+void PageMap::Extend(uintptr_t start, size_t size) {
+    min_addr_ = std::min(min_addr_, start);
+    max_addr_ = std::max(max_addr_, start + size);
+}
+
+void PageMap::Set(uintptr_t start, size_t size, PageMapEntry entry) {
+    if (!entry.IsEmpty()) {
+        Extend(start, size);
+    }
+    size_t last = (start + size - 1) >> kPageMapShift;
+    for (size_t page = start >> kPageMapShift; page <= last; ++page) {
+        LeafFor(page)->entries[page & (kPageMapLeafSize - 1)] = entry.Bits();
+    }
+}
+
+void PageMap::Clear(uintptr_t start, size_t size) {
+    Set(start, size, PageMapEntry());
+}
+
+void PageMap::AddMedium(uintptr_t start, size_t size) {
+    Extend(start, size);
+    size_t last = (start + size - 1) >> kPageMapShift;
+    for (size_t page = start >> kPageMapShift; page <= last; ++page) {
+        uintptr_t& bits = LeafFor(page)->entries[page & (kPageMapLeafSize - 1)];
+        bits = PageMapEntry::Medium(PageMapEntry(bits).MediumCount() + 1).Bits();
+    }
+}
+
+// sweep workers free medium objects concurrently, and neighbours may share a page
+void PageMap::RemoveMedium(uintptr_t start, size_t size) {
+    size_t last = (start + size - 1) >> kPageMapShift;
+    for (size_t page = start >> kPageMapShift; page <= last; ++page) {
+        std::atomic_ref<uintptr_t> bits(LeafFor(page)->entries[page & (kPageMapLeafSize - 1)]);
+        uintptr_t old = bits.load(std::memory_order_relaxed);
+        while (!bits.compare_exchange_weak(
+            old, PageMapEntry::Medium(PageMapEntry(old).MediumCount() - 1).Bits(),
+            std::memory_order_relaxed)) {
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct PageHeader;
+struct LargeObject;
+
+constexpr size_t kPageMapShift = 12;  // same as kPageShift
+constexpr size_t kPageMapLeafShift = 18;
+constexpr size_t kPageMapLeafSize = size_t{1} << kPageMapLeafShift;
+constexpr size_t kPageMapRootSize = size_t{1} << (47 - kPageMapShift - kPageMapLeafShift);
+
+// What covers a page of the address space. Entries are tagged words: a small-object page
+// header, the large object that owns the page or the number of medium objects overlapping it.
+class PageMapEntry {
+public:
+    PageMapEntry() = default;
+    explicit PageMapEntry(uintptr_t bits) : bits_(bits) {
+    }
+
+    static PageMapEntry SmallPage(PageHeader* page) {
+        return PageMapEntry(reinterpret_cast<uintptr_t>(page) | kSmallPageTag);
+    }
+    static PageMapEntry Large(LargeObject* object) {
+        return PageMapEntry(reinterpret_cast<uintptr_t>(object) | kLargeObjectTag);
+    }
+    static PageMapEntry Medium(size_t count) {
+        return PageMapEntry(count == 0 ? 0 : (count << kTagBits) | kMediumTag);
+    }
+
+    bool IsEmpty() const {
+        return bits_ == 0;
+    }
+    PageHeader* AsSmallPage() const {
+        return Tag() == kSmallPageTag ? reinterpret_cast<PageHeader*>(bits_ & ~kTagMask) : nullptr;
+    }
+    LargeObject* AsLarge() const {
+        return Tag() == kLargeObjectTag ? reinterpret_cast<LargeObject*>(bits_ & ~kTagMask)
+                                        : nullptr;
+    }
+    size_t MediumCount() const {
+        return Tag() == kMediumTag ? bits_ >> kTagBits : 0;
+    }
+    uintptr_t Bits() const {
+        return bits_;
+    }
+
+private:
+    static constexpr uintptr_t kTagBits = 2;
+    static constexpr uintptr_t kTagMask = (uintptr_t{1} << kTagBits) - 1;
+    static constexpr uintptr_t kSmallPageTag = 1, kLargeObjectTag = 2, kMediumTag = 3;
+
+    uintptr_t Tag() const {
+        return bits_ & kTagMask;
+    }
+
+    uintptr_t bits_ = 0;
+};
+
+// Two-level radix tree from page number to PageMapEntry, like the tcmalloc page map. A lookup is
+// two dependent loads. Leaves cover 1 GiB each and are mapped on first use, so only the parts of
+// the address space the collector allocates from cost memory. Writers must be serialized,
+// except that RemoveMedium calls may overlap each other. Lookups may run concurrently with
+// installing a leaf.
+class PageMap {
+public:
+    PageMap();
+    PageMap(const PageMap&) = delete;
+    PageMap& operator=(const PageMap&) = delete;
+    ~PageMap();
+
+    PageMapEntry Get(uintptr_t addr) const {
+        size_t page = addr >> kPageMapShift;
+        size_t root = page >> kPageMapLeafShift;
+        if (root >= kPageMapRootSize) {
+            return PageMapEntry();
+        }
+        const Leaf* leaf = root_[root].load(std::memory_order_acquire);
+        if (leaf == nullptr) {
+            return PageMapEntry();
+        }
+        return PageMapEntry(leaf->entries[page & (kPageMapLeafSize - 1)]);
+    }
+
+    // sets every page of [start, start + size), throws std::bad_alloc if a leaf can't be mapped
+    void Set(uintptr_t start, size_t size, PageMapEntry entry);
+    void Clear(uintptr_t start, size_t size);
+    // medium objects may share pages, so their pages count them
+    void AddMedium(uintptr_t start, size_t size);
+    void RemoveMedium(uintptr_t start, size_t size);
+
+    // range that holds every address ever set, it only grows
+    uintptr_t MinAddress() const {
+        return min_addr_;
+    }
+    uintptr_t MaxAddress() const {
+        return max_addr_;
+    }
+
+private:
+    struct Leaf {
+        uintptr_t entries[kPageMapLeafSize];
+    };
+
+    Leaf* LeafFor(size_t page);
+    void Extend(uintptr_t start, size_t size);
+
+    std::unique_ptr<std::atomic<Leaf*>[]> root_;
+    std::vector<Leaf*> leaves_;
+    uintptr_t min_addr_ = UINTPTR_MAX;
+    uintptr_t max_addr_ = 0;
+};
@@ -0,0 +1,88 @@
+#include "gc_poll_page.h"
+#include <new>
+#include <system_error>
+#ifdef __linux__
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+// the handler serves one page, the collector is a singleton
+static PollPage::ParkFn park_fn = nullptr;
+static void* park_arg = nullptr;
+static uintptr_t poll_start = 0;
+static uintptr_t poll_end = 0;
+static struct sigaction previous_action;
+
+// the fault is synchronous, a thread only takes it on the read in a safepoint, so it holds no
+// lock of the collector and parking may wait on futexes
+static void FaultHandler(int signal, siginfo_t* info, void* context) {
+    auto addr = reinterpret_cast<uintptr_t>(info->si_addr);
+    if (poll_start <= addr && addr < poll_end) {
+        park_fn(park_arg);
+        return;
+    }
+    if (previous_action.sa_flags & SA_SIGINFO) {
+        previous_action.sa_sigaction(signal, info, context);
+    } else if (previous_action.sa_handler == SIG_DFL || previous_action.sa_handler == SIG_IGN) {
+        // the access faults again and gets the default action
+        sigaction(SIGSEGV, &previous_action, nullptr);
+    } else {
+        previous_action.sa_handler(signal);
+    }
+}
+#endif
+
+PollPage::PollPage(ParkFn park, void* arg) : word_(&flag_) {
+#ifdef __linux__
+    size_ = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    void* page = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) {
+        throw std::bad_alloc{};
+    }
+    page_ = page;
+    word_ = static_cast<uint32_t*>(page);
+    park_fn = park;
+    park_arg = arg;
+    poll_start = reinterpret_cast<uintptr_t>(page_);
+    poll_end = poll_start + size_;
+    struct sigaction action = {};
+    action.sa_sigaction = FaultHandler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &previous_action) != 0) {
+        int error = errno;
+        munmap(page_, size_);
+        throw std::system_error(error, std::generic_category(), "sigaction");
+    }
+#else
+    (void)park;
+    (void)arg;
+#endif
+}
+
+PollPage::~PollPage() {
+#ifdef __linux__
+    // the handler stays, faults go on to the previous one
+    poll_start = poll_end = 0;
+    munmap(page_, size_);
+#endif
+}
+
+void PollPage::Arm() {
+#ifdef __linux__
+    mprotect(page_, size_, PROT_NONE);
+#else
+    std::atomic_ref<uint32_t>(*word_).store(1, std::memory_order_relaxed);
+#endif
+}
+
+void PollPage::Disarm() {
+#ifdef __linux__
+    mprotect(page_, size_, PROT_READ | PROT_WRITE);
+#else
+    std::atomic_ref<uint32_t>(*word_).store(0, std::memory_order_relaxed);
+#endif
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Page that safepoints read from, as in HotSpot's safepoint polling. A stop takes away read
+// access and the fault handler calls the park callback on the faulting thread, which retries the
+// read once the callback returns. Faults elsewhere go to the SIGSEGV handler installed before.
+// Pages are only protected on Linux, elsewhere a stop sets the first word and Poll checks it
+class PollPage {
+public:
+    using ParkFn = void (*)(void* arg);
+
+    // throws std::bad_alloc if the page can't be mapped, std::system_error if SIGSEGV can't be
+    // taken
+    PollPage(ParkFn park, void* arg);
+    PollPage(const PollPage&) = delete;
+    PollPage& operator=(const PollPage&) = delete;
+    ~PollPage();
+
+    // true if the caller has to park. On Linux a load whose value is unused and never true, it
+    // faults while the page is armed
+    bool Poll() const {
+#ifdef __linux__
+        static_cast<void>(*static_cast<const volatile uint32_t*>(word_));
+        return false;
+#else
+        return std::atomic_ref<uint32_t>(*word_).load(std::memory_order_relaxed) != 0;
+#endif
+    }
+
+    // reads park until Disarm
+    void Arm();
+    void Disarm();
+
+private:
+    uint32_t* word_;
+    uint32_t flag_ = 0;  // the word where pages can't be protected
+    void* page_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,60 @@
+#include "gc_root_registry.h"
+#include <utility>
+
+GCRootEntry* RootRegistry::Add(uintptr_t ptr, size_t size, bool hinted, bool by_address) {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (free_ == nullptr) {
+        chunks_.push_back(std::make_unique<GCRootEntry[]>(kRootEntryChunk));
+        GCRootEntry* chunk = chunks_.back().get();
+        for (size_t i = kRootEntryChunk; i-- > 0;) {
+            chunk[i].next_free = free_;
+            free_ = &chunk[i];
+        }
+    }
+    live_.push_back(free_);
+    GCRootEntry* entry = free_;
+    free_ = entry->next_free;
+    entry->next_free = nullptr;
+    entry->ptr = ptr;
+    entry->size = size;
+    entry->hinted = hinted;
+    entry->by_address = by_address;
+    entry->index = live_.size() - 1;
+    if (by_address) {
+        by_address_.emplace(ptr, entry);
+    }
+    return entry;
+}
+
+void RootRegistry::Unlink(GCRootEntry* entry) {
+    std::lock_guard<std::mutex> lock(lock_);
+    UnlinkLocked(entry);
+}
+
+std::vector<GCRootEntry*> RootRegistry::UnlinkAddress(uintptr_t ptr, bool all) {
+    std::lock_guard<std::mutex> lock(lock_);
+    std::vector<GCRootEntry*> unlinked;
+    auto [first, last] = all ? std::pair(by_address_.begin(), by_address_.end())
+                             : by_address_.equal_range(ptr);
+    for (auto it = first; it != last; ++it) {
+        UnlinkLocked(it->second);
+        unlinked.push_back(it->second);
+    }
+    by_address_.erase(first, last);
+    return unlinked;
+}
+
+void RootRegistry::UnlinkLocked(GCRootEntry* entry) {
+    GCRootEntry* moved = live_.back();
+    live_[entry->index] = moved;
+    moved->index = entry->index;
+    live_.pop_back();
+}
+
+void RootRegistry::Release(GCRootEntry* entry) {
+    std::lock_guard<std::mutex> lock(lock_);
+    entry->found = std::vector<uintptr_t>();
+    entry->changed.store(true);
+    entry->next_free = free_;
+    free_ = entry;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+constexpr size_t kRootEntryChunk = 256;  // entries allocated at once, they never move
+
+// A registered root, handles given out are the entry's address
+struct GCRootEntry {
+    uintptr_t ptr = 0;
+    size_t size = 0;
+    bool hinted = false;      // scanned through found until the root is marked changed
+    bool by_address = false;  // added with gc_add_root or gc_init, removed by its address
+    std::atomic<bool> changed = true;
+    std::vector<uintptr_t> found;  // words that pointed into the heap at the last full scan
+    size_t index = 0;              // position in the live list
+    GCRootEntry* next_free = nullptr;
+};
+
+// Roots of the collector. Entries come from chunks that never move and go back to a free list,
+// the live ones are kept in a dense list that an entry leaves by swapping with the last, so adding
+// and removing a root are O(1). The registry has its own lock, the collector holds it only while it
+// lists the roots in a pause. An unlinked entry may still be scanned by the running collection,
+// GCImpl releases it once the root scan is over.
+class RootRegistry {
+public:
+    RootRegistry() = default;
+    RootRegistry(const RootRegistry&) = delete;
+    RootRegistry& operator=(const RootRegistry&) = delete;
+
+    GCRootEntry* Add(uintptr_t ptr, size_t size, bool hinted, bool by_address);
+    // for entries handed out as handles, those added by address go through UnlinkAddress
+    void Unlink(GCRootEntry* entry);
+    // unlinks the roots added by address at ptr, or all of them if all is set
+    std::vector<GCRootEntry*> UnlinkAddress(uintptr_t ptr, bool all);
+    void Release(GCRootEntry* entry);
+
+    // the caller holds Lock()
+    template <typename Visitor>
+    void ForEach(Visitor visit) {
+        for (GCRootEntry* entry : live_) {
+            visit(entry);
+        }
+    }
+    std::mutex& Lock() {
+        return lock_;
+    }
+
+private:
+    void UnlinkLocked(GCRootEntry* entry);
+
+    std::mutex lock_;
+    std::vector<std::unique_ptr<GCRootEntry[]>> chunks_;
+    GCRootEntry* free_ = nullptr;
+    std::vector<GCRootEntry*> live_;
+    std::unordered_multimap<uintptr_t, GCRootEntry*> by_address_;
+};
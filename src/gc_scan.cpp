@@ -0,0 +1,130 @@
+#include "gc_scan.h"
+#include <algorithm>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// An address is in [min_addr, max_addr) iff addr - min_addr < max_addr - min_addr as unsigned
+// numbers. Vector compares are signed, so both sides get the sign bit flipped.
+
+size_t FilterWordsScalar(const uintptr_t* words, size_t count, uintptr_t min_addr,
+                         uintptr_t max_addr, uintptr_t* candidates) {
+    uintptr_t span = max_addr - min_addr;
+    size_t found = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uintptr_t word;
+        std::memcpy(&word, words + i, sizeof(word));
+        candidates[found] = word;
+        found += word - min_addr < span;
+    }
+    return found;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) size_t FilterWordsSse42(const uintptr_t* words, size_t count,
+                                                          uintptr_t min_addr, uintptr_t max_addr,
+                                                          uintptr_t* candidates) {
+    const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    const __m128i min = _mm_set1_epi64x(static_cast<int64_t>(min_addr));
+    const __m128i span = _mm_xor_si128(_mm_set1_epi64x(static_cast<int64_t>(max_addr - min_addr)),
+                                       sign);
+    size_t found = 0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i + 2));
+        __m128i lo_in = _mm_cmpgt_epi64(span, _mm_xor_si128(_mm_sub_epi64(lo, min), sign));
+        __m128i hi_in = _mm_cmpgt_epi64(span, _mm_xor_si128(_mm_sub_epi64(hi, min), sign));
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(lo_in)) |
+                   _mm_movemask_pd(_mm_castsi128_pd(hi_in)) << 2;
+        if (mask == 0) {
+            continue;
+        }
+        for (size_t lane = 0; lane < 4; ++lane) {
+            std::memcpy(candidates + found, words + i + lane, sizeof(uintptr_t));
+            found += (mask >> lane) & 1;
+        }
+    }
+    return found + FilterWordsScalar(words + i, count - i, min_addr, max_addr, candidates + found);
+}
+
+__attribute__((target("avx2"))) size_t FilterWordsAvx2(const uintptr_t* words, size_t count,
+                                                       uintptr_t min_addr, uintptr_t max_addr,
+                                                       uintptr_t* candidates) {
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i min = _mm256_set1_epi64x(static_cast<int64_t>(min_addr));
+    const __m256i span = _mm256_xor_si256(
+        _mm256_set1_epi64x(static_cast<int64_t>(max_addr - min_addr)), sign);
+    size_t found = 0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i + 4));
+        __m256i lo_in = _mm256_cmpgt_epi64(span, _mm256_xor_si256(_mm256_sub_epi64(lo, min), sign));
+        __m256i hi_in = _mm256_cmpgt_epi64(span, _mm256_xor_si256(_mm256_sub_epi64(hi, min), sign));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo_in)) |
+                   _mm256_movemask_pd(_mm256_castsi256_pd(hi_in)) << 4;
+        if (mask == 0) {
+            continue;
+        }
+        for (size_t lane = 0; lane < 8; ++lane) {
+            std::memcpy(candidates + found, words + i + lane, sizeof(uintptr_t));
+            found += (mask >> lane) & 1;
+        }
+    }
+    return found + FilterWordsScalar(words + i, count - i, min_addr, max_addr, candidates + found);
+}
+#endif
+
+static FilterWordsFn SelectFilterWords() {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        return FilterWordsAvx2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return FilterWordsSse42;
+    }
+#endif
+    return FilterWordsScalar;
+}
+
+size_t FilterWords(const uintptr_t* words, size_t count, uintptr_t min_addr, uintptr_t max_addr,
+                   uintptr_t* candidates) {
+    static const FilterWordsFn filter = SelectFilterWords();
+    return filter(words, count, min_addr, max_addr, candidates);
+}
+
+void SortAddresses(std::vector<uintptr_t>* keys, std::vector<uintptr_t>* scratch) {
+    constexpr size_t kRadixBits = 8;
+    constexpr size_t kBuckets = size_t{1} << kRadixBits;
+    // counting passes don't pay off for a handful of keys
+    if (keys->size() < kBuckets) {
+        std::sort(keys->begin(), keys->end());
+        return;
+    }
+    uintptr_t differ = 0;
+    for (uintptr_t key : *keys) {
+        differ |= key ^ keys->front();
+    }
+    scratch->resize(keys->size());
+    for (size_t shift = 0; shift < sizeof(uintptr_t) * 8; shift += kRadixBits) {
+        if (((differ >> shift) & (kBuckets - 1)) == 0) {
+            continue;
+        }
+        size_t offsets[kBuckets] = {};
+        for (uintptr_t key : *keys) {
+            ++offsets[(key >> shift) & (kBuckets - 1)];
+        }
+        size_t sum = 0;
+        for (size_t& offset : offsets) {
+            size_t count = offset;
+            offset = sum;
+            sum += count;
+        }
+        for (uintptr_t key : *keys) {
+            (*scratch)[offsets[(key >> shift) & (kBuckets - 1)]++] = key;
+        }
+        keys->swap(*scratch);
+    }
+}
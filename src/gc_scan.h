@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+constexpr size_t kScanBatch = 256;  // words filtered at once, candidates are kept on the stack
+
+// Copies the words of [words, words + count) that lie in [min_addr, max_addr) to candidates and
+// returns their number. candidates must have room for count words.
+using FilterWordsFn = size_t (*)(const uintptr_t* words, size_t count, uintptr_t min_addr,
+                                 uintptr_t max_addr, uintptr_t* candidates);
+
+size_t FilterWordsScalar(const uintptr_t* words, size_t count, uintptr_t min_addr,
+                         uintptr_t max_addr, uintptr_t* candidates);
+#if defined(__x86_64__)
+size_t FilterWordsSse42(const uintptr_t* words, size_t count, uintptr_t min_addr,
+                        uintptr_t max_addr, uintptr_t* candidates);
+size_t FilterWordsAvx2(const uintptr_t* words, size_t count, uintptr_t min_addr,
+                       uintptr_t max_addr, uintptr_t* candidates);
+#endif
+
+// Sorts addresses with an LSD radix sort. Bytes that are the same in every key, like the high
+// bytes of pointers into one heap, are skipped. scratch is reused between calls
+void SortAddresses(std::vector<uintptr_t>* keys, std::vector<uintptr_t>* scratch);
+
+// runs the best kernel the cpu supports, it is picked on the first call
+size_t FilterWords(const uintptr_t* words, size_t count, uintptr_t min_addr, uintptr_t max_addr,
+                   uintptr_t* candidates);
+
+// Calls visit for every word of [start, end) that looks like a pointer into [min_addr, max_addr).
+// Words are read at start, start + 8, ... as long as they fit, start doesn't have to be aligned.
+// Most words of roots and objects are nulls or small integers, so they are dropped
+// here without touching the page map.
+template <typename Visitor>
+void ScanWords(uintptr_t start, uintptr_t end, uintptr_t min_addr, uintptr_t max_addr,
+               Visitor visit) {
+    if (end < start + sizeof(uintptr_t) || min_addr >= max_addr) {
+        return;
+    }
+    size_t count = (end - start) / sizeof(uintptr_t);
+    const uintptr_t* words = reinterpret_cast<const uintptr_t*>(start);
+    uintptr_t candidates[kScanBatch];
+    for (size_t done = 0; done < count; done += kScanBatch) {
+        size_t batch = count - done < kScanBatch ? count - done : kScanBatch;
+        size_t found = FilterWords(words + done, batch, min_addr, max_addr, candidates);
+        for (size_t i = 0; i < found; ++i) {
+            visit(candidates[i]);
+        }
+    }
+}
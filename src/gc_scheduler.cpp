@@ -40,15 +40,20 @@ void GCScheduler::Shutdown() {
     }
 }
 
-void GCScheduler::TriggerCollect() {
+void GCScheduler::TriggerCollect(CollectionKind kind) {
+    if (kind == CollectionKind::kFull) {
+        full_requested_ = true;
+    }
+    ++collect_requests_;
     collect_triggered_ = true;
     loop_cv_.notify_one();
 }
 
 void GCScheduler::WaitCollect() {
+    // wait for a collection that started after the latest request
+    size_t target = collect_requests_.load();
     std::unique_lock<std::mutex> lock(wait_mutex_);
-    wait_collect_.wait(lock, [this] { return collect_done_.load(); });
-    collect_done_ = false;
+    wait_collect_.wait(lock, [this, target] { return collect_completed_.load() >= target; });
 }
 
 std::chrono::milliseconds GCScheduler::GetCollectionInterval() {
@@ -80,8 +85,8 @@ void GCScheduler::SetThresholdCalls(size_t calls) {
     pacer_.SetThresholdCalls(calls);
 }
 
-void GCScheduler::UpdateAllocationStats(size_t size) {
-    pacer_.Update(size, 1);
+void GCScheduler::UpdateAllocationStats(size_t size, size_t calls) {
+    pacer_.Update(size, calls);
     if (pacer_.ShouldTrigger()) {
         loop_cv_.notify_one();
     }
@@ -93,21 +98,36 @@ void GCScheduler::SchedulerLoop() {
         std::unique_lock<std::mutex> lock(lock_scheduler_);
         params_changed_ = false;
         wait_collect_.notify_one();
+        // a stopped scheduler only wakes for explicit requests, it would spin on stop_flag_
         bool notified = loop_cv_.wait_for(lock, collection_interval_, [this]() {
-            return stop_flag_.load() || params_changed_.load() || collect_triggered_.load() ||
-                   shutdown_.load() || pacer_.ShouldTrigger();
+            return params_changed_.load() || collect_triggered_.load() || shutdown_.load() ||
+                   (!stop_flag_.load() && pacer_.ShouldTrigger());
         });
         lock.unlock();
-        if ((!stop_flag_ && (pacer_.ShouldTrigger() || !notified)) || collect_triggered_.load()) {
-            collect_done_ = false;
-            gc_->Collect();
-            collect_done_ = true;
-            wait_collect_.notify_one();
-            ResetStats();
+        bool triggered = collect_triggered_.exchange(false);
+        size_t requests = collect_requests_.load();
+        if ((!stop_flag_ && (pacer_.ShouldTrigger() || !notified)) || triggered) {
+            gc_->Collect(ChooseCollection(full_requested_.exchange(false)));
+            pacer_.Reset();
+            {
+                std::lock_guard<std::mutex> wait_lock(wait_mutex_);
+                collect_completed_ = requests;
+            }
+            wait_collect_.notify_all();
         }
     }
 }
 
+CollectionKind GCScheduler::ChooseCollection(bool full_requested) {
+    // old objects only die in full collections, so they still have to run from time to time
+    if (full_requested || !gc_->IsGenerational() || minor_since_full_ >= kMinorCollectionsPerFull) {
+        minor_since_full_ = 0;
+        return CollectionKind::kFull;
+    }
+    ++minor_since_full_;
+    return CollectionKind::kMinor;
+}
+
 void GCScheduler::ResetStats() {
     collect_triggered_ = false;
     pacer_.Reset();
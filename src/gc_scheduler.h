@@ -11,6 +11,10 @@
 const constexpr size_t kDefaultThresholdBytes = 1024 * 1024, kDefaultThreasholdCalls = 1000;
 const constexpr std::chrono::milliseconds kDefaultGCInterval =
     std::chrono::milliseconds(1000) * 60 * 2;  // 2 minutes
+// in generational mode every this many minor collections are followed by a full one
+const constexpr size_t kMinorCollectionsPerFull = 8;
+
+enum class CollectionKind { kMinor, kFull };
 
 class GCScheduler {
 public:
@@ -19,12 +23,12 @@ public:
                 std::chrono::milliseconds collection_interval = kDefaultGCInterval);
     ~GCScheduler();
 
-    void UpdateAllocationStats(size_t size);
+    void UpdateAllocationStats(size_t size, size_t calls = 1);
     void Start();
     void Stop();
     void Shutdown();
 
-    void TriggerCollect();
+    void TriggerCollect(CollectionKind kind = CollectionKind::kFull);
     void WaitCollect();
 
     std::chrono::milliseconds GetCollectionInterval();
@@ -40,12 +44,15 @@ public:
 
 private:
     void SchedulerLoop();
+    CollectionKind ChooseCollection(bool full_requested);
 
     GCImpl* gc_;
     GCPacer pacer_;
     std::chrono::milliseconds collection_interval_;
-    std::atomic<bool> stop_flag_, params_changed_, collect_triggered_ = false,
-                                                   collect_done_ = false, shutdown_ = false;
+    std::atomic<bool> stop_flag_, params_changed_, collect_triggered_ = false, shutdown_ = false;
+    std::atomic<bool> full_requested_ = false;
+    std::atomic<size_t> collect_requests_ = 0, collect_completed_ = 0;
+    size_t minor_since_full_ = 0;
     std::thread scheduler_thread_;
     std::mutex lock_scheduler_;
     std::mutex wait_mutex_;
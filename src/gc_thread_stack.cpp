@@ -0,0 +1,141 @@
+#include "gc_thread_stack.h"
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#ifdef __linux__
+#include <semaphore.h>
+#endif
+
+#ifdef __linux__
+// the signals Boehm's collector uses on Linux, applications rarely handle them
+constexpr int kSuspendSignal = SIGPWR;
+constexpr int kResumeSignal = SIGXCPU;
+
+static sem_t suspend_ack;
+static std::atomic<uint64_t> resume_epoch = 0;
+static thread_local ThreadStack* current_stack = nullptr;
+
+// Runs on the stack of the interrupted thread, so everything from its frame up is live data of
+// the thread, the kernel's copy of the registers included. Only async-signal-safe calls here
+static void SuspendHandler(int, siginfo_t*, void* context) {
+    int saved_errno = errno;
+    ThreadStack* stack = current_stack;
+    if (stack == nullptr) {
+        errno = saved_errno;
+        return;
+    }
+    std::memcpy(stack->registers, context, sizeof(ucontext_t));
+    auto top = reinterpret_cast<uintptr_t>(&stack);
+    // a thread interrupted on an alternate signal stack keeps only its registers
+    stack->top = stack->limit <= top && top < stack->base ? top : stack->base;
+    uint64_t epoch = resume_epoch.load();
+    sem_post(&suspend_ack);
+    sigset_t wait_mask;
+    sigfillset(&wait_mask);
+    sigdelset(&wait_mask, kResumeSignal);
+    while (resume_epoch.load() == epoch) {
+        sigsuspend(&wait_mask);
+    }
+    errno = saved_errno;
+}
+
+static void ResumeHandler(int) {
+}
+
+static bool Install() {
+    if (sem_init(&suspend_ack, 0, 0) != 0) {
+        return false;
+    }
+    struct sigaction suspend = {};
+    suspend.sa_sigaction = SuspendHandler;
+    suspend.sa_flags = SA_SIGINFO | SA_RESTART;
+    // the resume signal stays pending until the handler waits for it
+    sigemptyset(&suspend.sa_mask);
+    sigaddset(&suspend.sa_mask, kResumeSignal);
+    struct sigaction resume = {};
+    resume.sa_handler = ResumeHandler;
+    resume.sa_flags = SA_RESTART;
+    sigemptyset(&resume.sa_mask);
+    return sigaction(kSuspendSignal, &suspend, nullptr) == 0 &&
+           sigaction(kResumeSignal, &resume, nullptr) == 0;
+}
+#endif
+
+bool InstallSuspendHandlers() {
+#ifdef __linux__
+    static bool installed = Install();
+    return installed;
+#else
+    return false;
+#endif
+}
+
+bool AttachThreadStack(ThreadStack* stack) {
+#ifdef __linux__
+    // the thread is stopped like the others even if its bounds are unknown
+    stack->thread = pthread_self();
+    current_stack = stack;
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+        return false;
+    }
+    void* addr = nullptr;
+    size_t size = 0;
+    int result = pthread_attr_getstack(&attr, &addr, &size);
+    pthread_attr_destroy(&attr);
+    if (result != 0) {
+        return false;
+    }
+    stack->limit = reinterpret_cast<uintptr_t>(addr);
+    stack->base = stack->limit + size;
+    stack->top = stack->base;
+    return true;
+#else
+    (void)stack;
+    return false;
+#endif
+}
+
+void DetachThreadStack() {
+#ifdef __linux__
+    current_stack = nullptr;
+#endif
+}
+
+void SaveThreadStack(ThreadStack* stack) {
+#ifdef __linux__
+    getcontext(reinterpret_cast<ucontext_t*>(stack->registers));
+    stack->top = reinterpret_cast<uintptr_t>(&stack);
+#else
+    (void)stack;
+#endif
+}
+
+void SuspendThreads(const std::vector<ThreadStack*>& stacks) {
+#ifdef __linux__
+    size_t signalled = 0;
+    for (ThreadStack* stack : stacks) {
+        if (pthread_kill(stack->thread, kSuspendSignal) == 0) {
+            ++signalled;
+        }
+    }
+    for (size_t i = 0; i < signalled; ++i) {
+        while (sem_wait(&suspend_ack) != 0 && errno == EINTR) {
+        }
+    }
+#else
+    (void)stacks;
+#endif
+}
+
+void ResumeThreads(const std::vector<ThreadStack*>& stacks) {
+#ifdef __linux__
+    resume_epoch.fetch_add(1);
+    for (ThreadStack* stack : stacks) {
+        pthread_kill(stack->thread, kResumeSignal);
+    }
+#else
+    (void)stacks;
+#endif
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <pthread.h>
+#include <ucontext.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Stack of a registered thread and what was saved of it when the thread was stopped
+struct ThreadStack {
+    pthread_t thread{};
+    uintptr_t limit = 0;  // lowest address of the stack
+    uintptr_t base = 0;   // end of the stack, stacks grow down
+    uintptr_t top = 0;    // lowest address in use when the thread was stopped
+    // registers of the stopped thread, pointers held only there are found through the copy
+    alignas(16) unsigned char registers[sizeof(ucontext_t)] = {};
+};
+
+// Threads are stopped with signals, as in Boehm's pthread_stop_world. The suspend handler saves
+// the registers and the stack pointer of the interrupted thread, acknowledges and waits in
+// sigsuspend for the resume signal. Linux only, InstallSuspendHandlers fails elsewhere.
+
+// installs the handlers once, false if the signals can't be taken
+bool InstallSuspendHandlers();
+// makes stack the one the suspend handler saves into for the calling thread, false if the
+// bounds of the thread's stack can't be read, they stay 0 then
+bool AttachThreadStack(ThreadStack* stack);
+void DetachThreadStack();
+// saves the calling thread itself, for a collecting thread that is registered
+void SaveThreadStack(ThreadStack* stack);
+// returns once every thread waits in the suspend handler. The threads must be attached and
+// must not exit before ResumeThreads
+void SuspendThreads(const std::vector<ThreadStack*>& stacks);
+void ResumeThreads(const std::vector<ThreadStack*>& stacks);
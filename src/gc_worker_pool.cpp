@@ -0,0 +1,132 @@
+#include "gc_worker_pool.h"
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef __linux__
+static cpu_set_t MakeCpuSet(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpus.empty()) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return set;
+}
+#endif
+
+GCWorkerPool::GCWorkerPool() {
+#ifdef __linux__
+    cpu_set_ = MakeCpuSet(cpus_);
+#endif
+}
+
+GCWorkerPool::~GCWorkerPool() {
+    Stop();
+}
+
+void GCWorkerPool::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+    stop_ = false;
+}
+
+void GCWorkerPool::Resize(size_t num_workers) {
+    size_t num_threads = num_workers > 0 ? num_workers - 1 : 0;
+    if (num_threads == threads_.size()) {
+        return;
+    }
+    Stop();
+    for (size_t id = 1; id <= num_threads; ++id) {
+        // a thread that starts late must still see the next Run as new
+        threads_.emplace_back(&GCWorkerPool::WorkerLoop, this, id, generation_);
+        ApplyAffinity(threads_.back());
+    }
+}
+
+void GCWorkerPool::SetAffinity(const std::vector<int>& cpus) {
+    cpus_ = cpus;
+#ifdef __linux__
+    cpu_set_ = MakeCpuSet(cpus_);
+#endif
+    for (auto& thread : threads_) {
+        ApplyAffinity(thread);
+    }
+}
+
+void GCWorkerPool::ApplyAffinity(std::thread& thread) const {
+#ifdef __linux__
+    // fails for cpus the process may not use, the thread keeps running where it did then
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_), &cpu_set_);
+#else
+    (void)thread;
+#endif
+}
+
+GCWorkerPool::CallerAffinity::CallerAffinity(const GCWorkerPool& pool) {
+#ifdef __linux__
+    if (pool.cpus_.empty()) {
+        return;
+    }
+    restore_ = pthread_getaffinity_np(pthread_self(), sizeof(saved_), &saved_) == 0 &&
+               pthread_setaffinity_np(pthread_self(), sizeof(pool.cpu_set_), &pool.cpu_set_) == 0;
+#else
+    (void)pool;
+#endif
+}
+
+GCWorkerPool::CallerAffinity::~CallerAffinity() {
+#ifdef __linux__
+    if (restore_) {
+        pthread_setaffinity_np(pthread_self(), sizeof(saved_), &saved_);
+    }
+#endif
+}
+
+void GCWorkerPool::Run(TaskRef task) {
+    if (threads_.empty()) {
+        task(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        task_ = &task;
+        running_ = threads_.size();
+        ++generation_;
+    }
+    wake_.notify_all();
+    task(0);
+    std::unique_lock<std::mutex> lock(lock_);
+    done_.wait(lock, [this] { return running_ == 0; });
+    task_ = nullptr;
+}
+
+void GCWorkerPool::WorkerLoop(size_t id, uint64_t seen) {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+        wake_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+        if (stop_) {
+            return;
+        }
+        seen = generation_;
+        const TaskRef* task = task_;
+        lock.unlock();
+        (*task)(id);
+        lock.lock();
+        if (--running_ == 0) {
+            done_.notify_one();
+        }
+    }
+}
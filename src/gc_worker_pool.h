@@ -0,0 +1,87 @@
+#pragma once
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Long-lived helper threads of the collector. They are parked on a condition variable between
+// collections, Run hands all of them the same task and the calling thread takes part as worker 0.
+// Resize and Run must not be called concurrently, GCImpl serializes them with lock_collect_.
+class GCWorkerPool {
+public:
+    GCWorkerPool();
+    GCWorkerPool(const GCWorkerPool&) = delete;
+    GCWorkerPool& operator=(const GCWorkerPool&) = delete;
+    ~GCWorkerPool();
+
+    // number of workers including the caller of Run, threads are started or stopped to match
+    void Resize(size_t num_workers);
+    size_t Size() const {
+        return threads_.size() + 1;
+    }
+    // cpus the threads may run on, empty lets them run anywhere
+    void SetAffinity(const std::vector<int>& cpus);
+
+    // pins the calling thread to the cpus of the pool for its lifetime, held by the thread that
+    // drives a collection. Nothing changes while the pool may run anywhere
+    class CallerAffinity {
+    public:
+        explicit CallerAffinity(const GCWorkerPool& pool);
+        CallerAffinity(const CallerAffinity&) = delete;
+        CallerAffinity& operator=(const CallerAffinity&) = delete;
+        ~CallerAffinity();
+
+    private:
+#ifdef __linux__
+        cpu_set_t saved_;
+#endif
+        bool restore_ = false;
+    };
+
+    // Reference to a task taking the worker id. Unlike std::function it never allocates, Run may
+    // be called while threads are stopped with signals. The task must outlive the reference
+    class TaskRef {
+    public:
+        template <typename Task>
+        TaskRef(const Task& task)
+            : task_(&task), call_([](const void* object, size_t id) {
+                  (*static_cast<const Task*>(object))(id);
+              }) {
+        }
+
+        void operator()(size_t id) const {
+            call_(task_, id);
+        }
+
+    private:
+        const void* task_;
+        void (*call_)(const void* task, size_t id);
+    };
+
+    // calls task(id) for every id in [0, Size()) and returns once all calls are done
+    void Run(TaskRef task);
+
+private:
+    void WorkerLoop(size_t id, uint64_t seen);
+    void ApplyAffinity(std::thread& thread) const;
+    void Stop();
+
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::vector<std::thread> threads_;
+    std::vector<int> cpus_;
+#ifdef __linux__
+    cpu_set_t cpu_set_;  // cpus_ as a mask
+#endif
+    const TaskRef* task_ = nullptr;
+    uint64_t generation_ = 0;  // bumped by every Run
+    size_t running_ = 0;
+    bool stop_ = false;
+};
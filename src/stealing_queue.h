@@ -1,35 +1,174 @@
-#include <deque>
-#include <mutex>
+#pragma once
 
+#include <sys/mman.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+// Chase-Lev work-stealing deque (Le et al., "Correct and Efficient Work-Stealing for Weak Memory
+// Models"). Only the owner thread may push and pop, at the bottom end; any thread may steal from
+// the top. Neither side takes a lock, the owner and thieves only race through a CAS on top when
+// they go for the same last element.
+//
+// Elements are kept as relaxed atomic words, so a thief that reads a slot the owner is reusing
+// gets a torn value instead of a data race. Its CAS on top fails then and the value is dropped.
+// Arrays are mapped rather than taken from malloc, the queue grows while threads stopped inside
+// malloc may hold its locks.
 template <typename T>
 class WorkStealingQueue {
+    static_assert(std::is_trivially_copyable_v<T> && sizeof(T) % sizeof(uint64_t) == 0);
+
 public:
-    void push(T a) {
-        std::lock_guard<std::mutex> lock(mtx_);
-        dq_.push_back(a);
+    explicit WorkStealingQueue(size_t capacity = 1024) {
+        size_t rounded = 1;
+        while (rounded < capacity) {
+            rounded *= 2;
+        }
+        array_.store(Array::Create(rounded, nullptr), std::memory_order_relaxed);
+    }
+    ~WorkStealingQueue() {
+        Array* array = array_.load(std::memory_order_relaxed);
+        while (array != nullptr) {
+            Array* previous = array->Previous();
+            Array::Destroy(array);
+            array = previous;
+        }
+    }
+    WorkStealingQueue(const WorkStealingQueue&) = delete;
+    WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+    // owner only
+    void push(T value) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        int64_t top = top_.load(std::memory_order_acquire);
+        Array* array = array_.load(std::memory_order_relaxed);
+        if (bottom - top >= static_cast<int64_t>(array->Capacity())) {
+            array = Grow(array, top, bottom);
+        }
+        array->Store(bottom, value);
+        bottom_.store(bottom + 1, std::memory_order_release);
     }
 
-    bool pop(T& a) {
-        std::lock_guard<std::mutex> lock(mtx_);
-        if (dq_.empty()) {
+    // owner only, takes the most recently pushed element
+    bool pop(T& value) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* array = array_.load(std::memory_order_relaxed);
+        // must be visible to thieves before top is read, or both could take the last element
+        bottom_.store(bottom, std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_seq_cst);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
             return false;
         }
-        a = std::move(dq_.back());
-        dq_.pop_back();
+        value = array->Load(bottom);
+        if (top == bottom) {
+            bool won = top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                                    std::memory_order_relaxed);
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return won;
+        }
         return true;
     }
 
-    bool steal(T& a) {
-        std::lock_guard<std::mutex> lock(mtx_);
-        if (dq_.empty()) {
+    // any thread, takes the oldest element. Fails if the queue is empty or another thread took
+    // the element first
+    bool steal(T& value) {
+        int64_t top = top_.load(std::memory_order_seq_cst);
+        int64_t bottom = bottom_.load(std::memory_order_seq_cst);
+        if (top >= bottom) {
+            return false;
+        }
+        Array* array = array_.load(std::memory_order_acquire);
+        T stolen = array->Load(top);
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
             return false;
         }
-        a = std::move(dq_.front());
-        dq_.pop_front();
+        value = stolen;
         return true;
     }
 
+    // a snapshot, may be stale by the time it returns unless called by the owner
+    bool empty() const {
+        return top_.load(std::memory_order_acquire) >= bottom_.load(std::memory_order_acquire);
+    }
+
 private:
-    std::deque<T> dq_;
-    std::mutex mtx_;
+    static constexpr size_t kWords = sizeof(T) / sizeof(uint64_t);
+
+    // the slots follow the header in the same mapping
+    class Array {
+    public:
+        static Array* Create(size_t capacity, Array* previous) {
+            size_t bytes = sizeof(Array) + capacity * kWords * sizeof(uint64_t);
+            void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                             -1, 0);
+            if (mem == MAP_FAILED) {
+                throw std::bad_alloc{};
+            }
+            return new (mem) Array(capacity, previous, bytes);
+        }
+        static void Destroy(Array* array) {
+            munmap(array, array->bytes_);
+        }
+
+        Array* Previous() const {
+            return previous_;
+        }
+        size_t Capacity() const {
+            return mask_ + 1;
+        }
+        void Store(int64_t index, const T& value) {
+            uint64_t words[kWords];
+            std::memcpy(words, &value, sizeof(T));
+            std::atomic<uint64_t>* slot = &slots_[(index & mask_) * kWords];
+            for (size_t i = 0; i < kWords; ++i) {
+                slot[i].store(words[i], std::memory_order_relaxed);
+            }
+        }
+        T Load(int64_t index) const {
+            uint64_t words[kWords];
+            const std::atomic<uint64_t>* slot = &slots_[(index & mask_) * kWords];
+            for (size_t i = 0; i < kWords; ++i) {
+                words[i] = slot[i].load(std::memory_order_relaxed);
+            }
+            T value;
+            std::memcpy(&value, words, sizeof(T));
+            return value;
+        }
+
+    private:
+        Array(size_t capacity, Array* previous, size_t bytes)
+            : mask_(capacity - 1),
+              bytes_(bytes),
+              previous_(previous),
+              slots_(reinterpret_cast<std::atomic<uint64_t>*>(this + 1)) {
+            for (size_t i = 0; i < capacity * kWords; ++i) {
+                new (&slots_[i]) std::atomic<uint64_t>(0);
+            }
+        }
+
+        size_t mask_;
+        size_t bytes_;
+        Array* previous_;
+        std::atomic<uint64_t>* slots_;
+    };
+
+    // old arrays stay alive until the queue dies, a thief may still read from them
+    Array* Grow(Array* array, int64_t top, int64_t bottom) {
+        Array* grown = Array::Create(array->Capacity() * 2, array);
+        for (int64_t i = top; i < bottom; ++i) {
+            grown->Store(i, array->Load(i));
+        }
+        array_.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+    // top and bottom are written by different threads, keep them on separate cache lines
+    alignas(64) std::atomic<int64_t> top_ = 0;
+    alignas(64) std::atomic<int64_t> bottom_ = 0;
+    std::atomic<Array*> array_;  // the newest, it links to the ones it replaced
 };
@@ -0,0 +1,86 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "gc_allocation_index.h"
+
+// layout of allocation table entries before the index, searched with std::upper_bound
+struct TableEntry {
+    uintptr_t ptr;
+    size_t size;
+    void (*finalizer)(void*, size_t);
+    size_t last_valid_time;
+};
+
+constexpr size_t kIndexSeed = 204;
+constexpr size_t kQueries = 1 << 16;
+
+static std::vector<TableEntry> MakeTable(size_t count) {
+    std::mt19937_64 gen(kIndexSeed);
+    std::uniform_int_distribution<size_t> size_dist(2049, 16384);
+    std::vector<TableEntry> table(count);
+    uintptr_t ptr = 0x100000000;
+    for (TableEntry& entry : table) {
+        entry = TableEntry{ptr, size_dist(gen), nullptr, 0};
+        ptr += entry.size + 16;
+    }
+    return table;
+}
+
+// mark phase mix: mostly pointers into objects, some miss between them or outside the heap
+static std::vector<uintptr_t> MakeQueries(const std::vector<TableEntry>& table) {
+    std::mt19937_64 gen(kIndexSeed + 1);
+    std::uniform_int_distribution<size_t> entry_dist(0, table.size() - 1);
+    std::uniform_int_distribution<int> kind_dist(0, 9);
+    std::vector<uintptr_t> queries(kQueries);
+    for (uintptr_t& query : queries) {
+        const TableEntry& entry = table[entry_dist(gen)];
+        int kind = kind_dist(gen);
+        query = kind == 0 ? entry.ptr + entry.size + 8 : kind == 1 ? gen() : entry.ptr + kind * 8;
+    }
+    return queries;
+}
+
+static void BM_FindAllocationUpperBound(benchmark::State& state) {
+    std::vector<TableEntry> table = MakeTable(state.range(0));
+    std::vector<uintptr_t> queries = MakeQueries(table);
+    size_t i = 0;
+    for (auto _ : state) {
+        uintptr_t ptr = queries[i++ % kQueries];
+        auto it = std::upper_bound(
+            table.begin(), table.end(), ptr,
+            [](uintptr_t value, const TableEntry& entry) { return value < entry.ptr; });
+        bool found = it != table.begin() && ptr < std::prev(it)->ptr + std::prev(it)->size;
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindAllocationUpperBound)->RangeMultiplier(10)->Range(10000, 10000000);
+
+static void BM_FindAllocationIndex(benchmark::State& state) {
+    std::vector<TableEntry> table = MakeTable(state.range(0));
+    std::vector<uintptr_t> queries = MakeQueries(table);
+    AllocationIndex index;
+    index.Build(table);
+    size_t i = 0;
+    for (auto _ : state) {
+        size_t found = index.Find(queries[i++ % kQueries]);
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindAllocationIndex)->RangeMultiplier(10)->Range(10000, 10000000);
+
+static void BM_AllocationIndexBuild(benchmark::State& state) {
+    std::vector<TableEntry> table = MakeTable(state.range(0));
+    AllocationIndex index;
+    for (auto _ : state) {
+        index.Build(table);
+    }
+    state.SetItemsProcessed(table.size() * state.iterations());
+}
+BENCHMARK(BM_AllocationIndexBuild)
+    ->RangeMultiplier(10)
+    ->Range(10000, 10000000)
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "gc_allocation_index.h"
+#include "gc_allocation_table.h"
+
+struct TestRange {
+    uintptr_t ptr;
+    size_t size;
+};
+
+TEST(AllocationIndexTest, MatchesBinarySearch) {
+    std::mt19937_64 gen(204);
+    std::uniform_int_distribution<size_t> size_dist(1, 100);
+    for (size_t count : {0, 1, 2, 3, 7, 8, 100, 1023, 1024, 1025}) {
+        std::vector<TestRange> ranges(count);
+        uintptr_t ptr = 1000;
+        for (TestRange& range : ranges) {
+            range = TestRange{ptr, size_dist(gen)};
+            ptr += range.size + size_dist(gen) % 3 * 16;
+        }
+        AllocationIndex index;
+        index.Build(ranges);
+        ASSERT_EQ(index.Size(), count);
+        for (uintptr_t query = 0; query < ptr + 100; ++query) {
+            auto it = std::upper_bound(
+                ranges.begin(), ranges.end(), query,
+                [](uintptr_t value, const TestRange& range) { return value < range.ptr; });
+            size_t expected = AllocationIndex::kNotFound;
+            if (it != ranges.begin() && query < std::prev(it)->ptr + std::prev(it)->size) {
+                expected = std::prev(it) - ranges.begin();
+            }
+            ASSERT_EQ(index.Find(query), expected) << count << " " << query;
+        }
+    }
+}
+
+static void NoFinalizer(void*, size_t) {
+}
+
+TEST(AllocationTableTest, SweepKeepsMarkedEntries) {
+    AllocationTable table;
+    constexpr size_t kCount = 5000;
+    for (size_t i = 0; i < kCount; ++i) {
+        table.Insert(Allocation{1000 + i * 64, 48, NoFinalizer});
+    }
+    table.Seal();
+    EXPECT_LE(table.NumRuns(), 4u);
+
+    Allocation erased;
+    ASSERT_TRUE(table.Erase(1000 + 7 * 64 + 10, &erased));
+    EXPECT_EQ(erased.ptr, 1000 + 7 * 64);
+    AllocationRef ref;
+    EXPECT_FALSE(table.Find(1000 + 7 * 64, &ref));
+    EXPECT_FALSE(table.Find(1000 + 64 + 48, &ref));
+
+    for (size_t i = 0; i < kCount; i += 3) {
+        if (table.Find(1000 + i * 64 + 47, &ref)) {
+            EXPECT_EQ(ref.Get().ptr, 1000 + i * 64);
+            EXPECT_TRUE(AllocationTable::TestAndMark(ref));
+            EXPECT_FALSE(AllocationTable::TestAndMark(ref));
+        }
+    }
+    size_t dead = 0;
+    size_t num_chunks = table.PrepareSweep();
+    for (size_t i = 0; i < num_chunks; ++i) {
+        table.SweepChunk(i, [&dead](const Allocation& alloc) {
+            EXPECT_NE((alloc.ptr - 1000) / 64 % 3, 0u);
+            ++dead;
+        });
+    }
+    table.FinishSweep();
+    EXPECT_EQ(dead, kCount - (kCount + 2) / 3 - 1);
+    for (size_t i = 0; i < kCount; ++i) {
+        bool live = i % 3 == 0;
+        ASSERT_EQ(table.Find(1000 + i * 64, &ref), live) << i;
+        if (live) {
+            EXPECT_TRUE(AllocationTable::IsMarked(ref));
+        }
+    }
+
+    // entries added after the sweep are young until the next one
+    table.Insert(Allocation{1000 + 7 * 64, 48, NoFinalizer});
+    table.Seal();
+    ASSERT_TRUE(table.Find(1000 + 7 * 64, &ref));
+    EXPECT_FALSE(AllocationTable::IsMarked(ref));
+}
+
+TEST(AllocationTableTest, SealLeavesBigMergesToTheSweep) {
+    AllocationTable table;
+    constexpr size_t kCount = 8 * kSealMergeEntries;
+    for (size_t i = 0; i < kCount; ++i) {
+        table.Insert(Allocation{1000 + i * 64, 48, NoFinalizer});
+    }
+    table.Seal();
+    size_t sealed_runs = table.NumRuns();
+    EXPECT_GE(sealed_runs, kCount / kSealMergeEntries);
+    AllocationRef ref;
+    for (size_t i = 0; i < kCount; ++i) {
+        ASSERT_TRUE(table.Find(1000 + i * 64, &ref)) << i;
+        AllocationTable::TestAndMark(ref);
+    }
+
+    size_t num_chunks = table.PrepareSweep();
+    EXPECT_EQ(num_chunks, 0u);
+    table.FinishSweep();
+    EXPECT_LT(table.NumRuns(), sealed_runs);
+    for (size_t i = 0; i < kCount; ++i) {
+        ASSERT_TRUE(table.Find(1000 + i * 64 + 10, &ref)) << i;
+        EXPECT_TRUE(AllocationTable::IsMarked(ref));
+    }
+}
+
+TEST(AllocationTableTest, RunsStayLogarithmicWithoutSweeps) {
+    AllocationTable table;
+    constexpr size_t kCount = 64 * kSealMergeEntries;
+    for (size_t i = 1; i <= kCount; ++i) {
+        table.Insert(Allocation{1000 + i * 64, 48, NoFinalizer});
+        if (i % kAllocationRunCapacity == 0) {
+            ASSERT_LE(table.NumRuns(), 2 * std::bit_width(i)) << i;
+        }
+    }
+    EXPECT_LT(table.NumRuns(), kCount / kSealMergeEntries);
+    AllocationRef ref;
+    for (size_t i = 1; i <= kCount; ++i) {
+        ASSERT_TRUE(table.Find(1000 + i * 64 + 10, &ref)) << i;
+    }
+}
+
+TEST(AllocationTableTest, SweepChunksOnSeveralThreads) {
+    AllocationTable table;
+    constexpr size_t kCount = 5 * kSweepChunkEntries + 100;
+    for (size_t i = 0; i < kCount; ++i) {
+        table.Insert(Allocation{1000 + i * 64, 48, NoFinalizer});
+    }
+    table.Seal();
+    AllocationRef ref;
+    for (size_t i = 0; i < kCount; i += 5) {
+        ASSERT_TRUE(table.Find(1000 + i * 64, &ref));
+        AllocationTable::TestAndMark(ref);
+    }
+
+    size_t num_chunks = table.PrepareSweep();
+    EXPECT_GT(num_chunks, 4u);
+    std::atomic<size_t> next = 0, dead = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&] {
+            size_t index;
+            while ((index = next.fetch_add(1)) < num_chunks) {
+                table.SweepChunk(index, [&dead](const Allocation&) { ++dead; });
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    table.FinishSweep();
+
+    EXPECT_EQ(dead, kCount - (kCount + 4) / 5);
+    for (size_t i = 0; i < kCount; ++i) {
+        ASSERT_EQ(table.Find(1000 + i * 64 + 10, &ref), i % 5 == 0) << i;
+    }
+}
+
+TEST(AllocationTableTest, MarkSortedMatchesFind) {
+    std::mt19937_64 gen(204);
+    AllocationTable table;
+    uintptr_t ptr = 1 << 20;
+    for (size_t i = 0; i < 5000; ++i) {
+        size_t size = 32 + gen() % 200;
+        table.Insert(Allocation{ptr, size, NoFinalizer});
+        ptr += size + gen() % 3 * 16;
+        if (i % 1500 == 0) {
+            table.Seal();
+        }
+    }
+    table.Seal();
+    Allocation erased;
+    ASSERT_TRUE(table.Erase((1 << 20) + 1000, &erased));
+
+    std::vector<uintptr_t> addrs(3000);
+    for (uintptr_t& addr : addrs) {
+        addr = (1 << 20) - 100 + gen() % (ptr - (1 << 20) + 200);
+    }
+    std::sort(addrs.begin(), addrs.end());
+    std::vector<uintptr_t> marked;
+    table.MarkSorted(addrs.data(), addrs.size(),
+                     [&marked](const Allocation& alloc) { marked.push_back(alloc.ptr); });
+
+    std::vector<uintptr_t> expected;
+    for (uintptr_t addr : addrs) {
+        AllocationRef ref;
+        if (table.Find(addr, &ref)) {
+            EXPECT_TRUE(AllocationTable::IsMarked(ref)) << addr;
+            expected.push_back(ref.Get().ptr);
+        }
+    }
+    expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+    std::sort(marked.begin(), marked.end());
+    EXPECT_EQ(marked, expected);
+}
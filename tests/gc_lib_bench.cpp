@@ -1,6 +1,10 @@
+#include <algorithm>
+#include <atomic>
 #include <benchmark/benchmark.h>
+#include <chrono>
 #include <vector>
 #include <random>
+#include <thread>
 
 #include "gc.h"
 #include "memory_actions.h"
@@ -43,6 +47,190 @@ static void BM_GcRealloc(benchmark::State& state) {
 }
 BENCHMARK(BM_GcRealloc)->UseRealTime()->MeasureProcessCPUTime()->Unit(benchmark::kMicrosecond);
 
+static void BM_GcMallocSmall(benchmark::State& state) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    const size_t size = state.range(0);
+    constexpr size_t kBatch = 10000;
+    for (auto _ : state) {
+        for (size_t i = 0; i < kBatch; ++i) {
+            benchmark::DoNotOptimize(gc_malloc_default(size));
+        }
+        state.PauseTiming();
+        gc_collect_blocked();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(kBatch * state.iterations());
+}
+BENCHMARK(BM_GcMallocSmall)
+    ->Arg(16)
+    ->Arg(64)
+    ->Arg(256)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// Pattern of MultiThreadGCTest.MultithreadedAllocation, arg selects registered threads that
+// allocate through thread caches instead of the shared allocation lock
+static void BM_GcMultithreadedAllocation(benchmark::State& state) {
+    const bool registered = state.range(0) != 0;
+    constexpr size_t kBatch = 1000;
+    if (state.thread_index() == 0) {
+        gc_disable_auto();
+        gc_init(nullptr, 0);
+    }
+    if (registered) {
+        gc_register_thread();
+    }
+    for (auto _ : state) {
+        for (size_t i = 0; i < kBatch; ++i) {
+            benchmark::DoNotOptimize(gc_malloc_default(64));
+        }
+    }
+    if (registered) {
+        gc_deregister_thread();
+    }
+    state.SetItemsProcessed(kBatch * state.iterations());
+}
+BENCHMARK(BM_GcMultithreadedAllocation)
+    ->Arg(0)
+    ->Arg(1)
+    ->ThreadRange(1, 8)
+    ->Iterations(100)
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+static void BM_GcLargeObjects(benchmark::State& state) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    const size_t size = state.range(0) * 1024 * 1024;
+    constexpr size_t kObjects = 16;
+    for (auto _ : state) {
+        for (size_t i = 0; i < kObjects; ++i) {
+            char* ptr = static_cast<char*>(gc_malloc_default(size));
+            ptr[0] = ptr[size - 1] = 1;
+        }
+        gc_collect_blocked();
+    }
+    state.SetItemsProcessed(kObjects * state.iterations());
+}
+BENCHMARK(BM_GcLargeObjects)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(64)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// Arg 0 collects the whole heap every iteration, arg 1 does minor collections in generational mode
+static void BM_GcGenerationalPause(benchmark::State& state) {
+    gc_disable_auto();
+    const bool generational = state.range(0) != 0;
+    constexpr size_t kChunks = 256, kChunkSlots = 1024, kStores = 64, kGarbage = 1000;
+    std::mt19937 gen(kSeed);
+    std::uniform_int_distribution<size_t> slot_dist(0, kChunks * kChunkSlots - 1);
+
+    std::vector<void**> chunks(kChunks);
+    GCRoot root = {chunks.data(), chunks.size() * sizeof(void*)};
+    gc_init(&root, 1);
+    for (void**& chunk : chunks) {
+        chunk = static_cast<void**>(gc_malloc_default(kChunkSlots * sizeof(void*)));
+        for (size_t i = 0; i < kChunkSlots; ++i) {
+            chunk[i] = gc_malloc_default(64);
+        }
+    }
+    gc_collect_blocked();
+    if (generational) {
+        gc_enable_generational();
+    }
+    GCStats before;
+    gc_get_stats(&before);
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < kStores; ++i) {
+            size_t slot = slot_dist(gen);
+            void** chunk = chunks[slot / kChunkSlots];
+            chunk[slot % kChunkSlots] = gc_malloc_default(64);
+            gc_write_barrier(chunk, &chunk[slot % kChunkSlots]);
+        }
+        for (size_t i = 0; i < kGarbage; ++i) {
+            gc_malloc_default(64);
+        }
+        if (generational) {
+            gc_collect_minor();
+            gc_wait_collect();
+        } else {
+            gc_collect_blocked();
+        }
+    }
+
+    GCStats after;
+    gc_get_stats(&after);
+    size_t minor = after.minor_collections - before.minor_collections;
+    size_t full = after.full_collections - before.full_collections;
+    state.counters["minor_pause_us"] =
+        minor == 0 ? 0 : (after.total_minor_pause_ns - before.total_minor_pause_ns) / minor / 1e3;
+    state.counters["full_pause_us"] =
+        full == 0 ? 0 : (after.total_full_pause_ns - before.total_full_pause_ns) / full / 1e3;
+    gc_disable_generational();
+    gc_init(nullptr, 0);
+    gc_collect_blocked();
+}
+BENCHMARK(BM_GcGenerationalPause)
+    ->Arg(0)
+    ->Arg(1)
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// Arg 1 writes into every old chunk once before the measured minor collections, arg 0 doesn't.
+// Cards are clean again after the first minor collection, so both report the same pause
+static void BM_GcMinorPauseAfterStores(benchmark::State& state) {
+    gc_disable_auto();
+    constexpr size_t kChunks = 256, kChunkSlots = 1024;
+    std::vector<void**> chunks(kChunks);
+    GCRoot root = {chunks.data(), chunks.size() * sizeof(void*)};
+    gc_init(&root, 1);
+    for (void**& chunk : chunks) {
+        chunk = static_cast<void**>(gc_malloc_default(kChunkSlots * sizeof(void*)));
+        for (size_t i = 0; i < kChunkSlots; ++i) {
+            chunk[i] = gc_malloc_default(64);
+        }
+    }
+    gc_collect_blocked();
+    gc_enable_generational();
+    if (state.range(0) != 0) {
+        for (void** chunk : chunks) {
+            for (size_t i = 0; i < kChunkSlots; ++i) {
+                chunk[i] = gc_malloc_default(64);
+                gc_write_barrier(chunk, &chunk[i]);
+            }
+        }
+        gc_collect_minor();
+        gc_wait_collect();
+    }
+    GCStats before;
+    gc_get_stats(&before);
+
+    for (auto _ : state) {
+        gc_collect_minor();
+        gc_wait_collect();
+    }
+
+    GCStats after;
+    gc_get_stats(&after);
+    size_t minor = after.minor_collections - before.minor_collections;
+    state.counters["minor_pause_us"] =
+        minor == 0 ? 0 : (after.total_minor_pause_ns - before.total_minor_pause_ns) / minor / 1e3;
+    gc_disable_generational();
+    gc_init(nullptr, 0);
+    gc_collect_blocked();
+}
+BENCHMARK(BM_GcMinorPauseAfterStores)
+    ->Arg(0)
+    ->Arg(1)
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
 static void BM_GcCollect_Drop5(benchmark::State& state) {
     gc_disable_auto();
     const size_t num_objects = 10000;
@@ -111,6 +299,304 @@ BENCHMARK(BM_GcCollect_DropProb)
     ->MeasureProcessCPUTime()
     ->Unit(benchmark::kMicrosecond);
 
+static void TouchFinalizer(void* ptr, size_t) {
+    benchmark::DoNotOptimize(*static_cast<volatile char*>(ptr));
+}
+
+// every collection finds the whole heap dead, the pause shrinks to marking with background sweep
+static void BM_GcSweepPause(benchmark::State& state) {
+    gc_disable_auto();
+    const size_t num_objects = 100000;
+    if (state.range(0)) {
+        gc_enable_background_sweep();
+    }
+    gc_init(nullptr, 0);
+    gc_collect_blocked();
+    GCStats before;
+    gc_get_stats(&before);
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (size_t i = 0; i < num_objects; ++i) {
+            gc_malloc(i % 50 == 0 ? 4096 : 64, TouchFinalizer);
+        }
+        state.ResumeTiming();
+        gc_collect_blocked();
+    }
+    GCStats after;
+    gc_get_stats(&after);
+    state.counters["full_pause_us"] = (after.total_full_pause_ns - before.total_full_pause_ns) /
+                                      (after.full_collections - before.full_collections) / 1e3;
+    gc_disable_background_sweep();
+}
+BENCHMARK(BM_GcSweepPause)->Arg(0)->Arg(1)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+// the whole heap is live, with concurrent marking the pauses only scan the root and the
+// pointers logged by the barrier (mode 1) or the pages written meanwhile (mode 2)
+static void BM_GcMarkPause(benchmark::State& state) {
+    gc_disable_auto();
+    const size_t num_objects = state.range(0);
+    if (state.range(1) == 1) {
+        gc_enable_concurrent_mark();
+    }
+    if (state.range(1) == 2 && !gc_enable_dirty_page_mark()) {
+        state.SkipWithError("no dirty page tracking");
+        return;
+    }
+    void** head = nullptr;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&head), sizeof(head)}};
+    gc_init(roots, 1);
+    for (size_t i = 0; i < num_objects; ++i) {
+        void** node = static_cast<void**>(gc_malloc_default(64));
+        *node = head;
+        head = node;
+    }
+    gc_collect_blocked();
+    GCStats before;
+    gc_get_stats(&before);
+    for (auto _ : state) {
+        gc_collect_blocked();
+    }
+    GCStats after;
+    gc_get_stats(&after);
+    state.counters["full_pause_us"] = (after.total_full_pause_ns - before.total_full_pause_ns) /
+                                      (after.full_collections - before.full_collections) / 1e3;
+    gc_disable_concurrent_mark();
+    gc_disable_dirty_page_mark();
+    gc_init(nullptr, 0);
+    gc_collect_blocked();
+}
+BENCHMARK(BM_GcMarkPause)
+    ->Args({100000, 0})
+    ->Args({100000, 1})
+    ->Args({100000, 2})
+    ->Args({1000000, 0})
+    ->Args({1000000, 1})
+    ->Args({1000000, 2})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// List of 1 KiB records whose first arg percent of words are pointers and the rest numbers, the
+// second arg selects typed allocation over scanning the records whole
+static void BM_GcTypedMark(benchmark::State& state) {
+    gc_disable_auto();
+    constexpr size_t kWords = 128;
+    constexpr size_t kRecords = 20000;
+    const size_t pointer_words = std::max<size_t>(1, kWords * state.range(0) / 100);
+    uint64_t bitmap[kWords / 64] = {};
+    for (size_t word = 0; word < pointer_words; ++word) {
+        bitmap[word / 64] |= uint64_t{1} << (word % 64);
+    }
+    GCDescriptor descriptor = state.range(1) != 0 ? gc_make_descriptor(bitmap, kWords) : nullptr;
+    void** head = nullptr;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&head), sizeof(head)}};
+    gc_init(roots, 1);
+    for (size_t i = 0; i < kRecords; ++i) {
+        void** record = static_cast<void**>(
+            gc_malloc_typed(kWords * sizeof(void*), descriptor, BasicFinalizer));
+        for (size_t word = 0; word < pointer_words; ++word) {
+            record[word] = head;
+        }
+        double* numbers = reinterpret_cast<double*>(record);
+        for (size_t word = pointer_words; word < kWords; ++word) {
+            numbers[word] = static_cast<double>(i * kWords + word) * 0.5;
+        }
+        head = record;
+    }
+    gc_collect_blocked();
+    GCStats before;
+    gc_get_stats(&before);
+    for (auto _ : state) {
+        gc_collect_blocked();
+    }
+    GCStats after;
+    gc_get_stats(&after);
+    state.counters["full_pause_us"] = (after.total_full_pause_ns - before.total_full_pause_ns) /
+                                      (after.full_collections - before.full_collections) / 1e3;
+    gc_init(nullptr, 0);
+    gc_collect_blocked();
+}
+BENCHMARK(BM_GcTypedMark)
+    ->Args({100, 0})
+    ->Args({100, 1})
+    ->Args({50, 1})
+    ->Args({10, 1})
+    ->Args({1, 1})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// a whole cycle in slices of 200 us, p99 of the slices shows how well calls keep the budget
+static void BM_GcStep(benchmark::State& state) {
+    gc_disable_auto();
+    const size_t num_objects = state.range(0);
+    void** head = nullptr;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&head), sizeof(head)}};
+    gc_init(roots, 1);
+    for (size_t i = 0; i < num_objects; ++i) {
+        void** node = static_cast<void**>(gc_malloc_default(64));
+        *node = head;
+        head = node;
+    }
+    gc_collect_blocked();
+    std::vector<double> steps_us;
+    for (auto _ : state) {
+        bool done = false;
+        while (!done) {
+            auto start = std::chrono::steady_clock::now();
+            done = gc_step(200);
+            std::chrono::duration<double, std::micro> took =
+                std::chrono::steady_clock::now() - start;
+            steps_us.push_back(took.count());
+        }
+    }
+    std::sort(steps_us.begin(), steps_us.end());
+    state.counters["steps"] = static_cast<double>(steps_us.size()) / state.iterations();
+    state.counters["p99_step_us"] = steps_us[steps_us.size() * 99 / 100];
+    gc_init(nullptr, 0);
+    gc_collect_blocked();
+}
+BENCHMARK(BM_GcStep)->Arg(100000)->Arg(1000000)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+// registered threads that spend most of their time asleep in a blocking region, the stop waits
+// only for the ones between two sleeps
+static void BM_GcTimeToSafepoint(benchmark::State& state) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    std::atomic<bool> running = true;
+    std::vector<std::thread> threads;
+    for (int64_t t = 0; t < state.range(0); ++t) {
+        threads.emplace_back([&running] {
+            gc_register_thread();
+            while (running) {
+                gc_enter_blocking();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                gc_leave_blocking();
+                benchmark::DoNotOptimize(gc_malloc_default(64));
+            }
+            gc_deregister_thread();
+        });
+    }
+    uint64_t total_ns = 0, max_ns = 0;
+    for (auto _ : state) {
+        gc_collect_blocked();
+        GCStats stats;
+        gc_get_stats(&stats);
+        total_ns += stats.last_time_to_safepoint_ns;
+        max_ns = std::max(max_ns, stats.last_time_to_safepoint_ns);
+    }
+    running = false;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    state.counters["time_to_safepoint_us"] = total_ns / 1e3 / state.iterations();
+    state.counters["max_time_to_safepoint_us"] = max_ns / 1e3;
+}
+BENCHMARK(BM_GcTimeToSafepoint)->Arg(1)->Arg(8)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+// cost of a safepoint while nothing stops the world
+static void BM_GcSafepoint(benchmark::State& state) {
+    gc_disable_auto();
+    constexpr size_t kBatch = 1000;
+    for (auto _ : state) {
+        for (size_t i = 0; i < kBatch; ++i) {
+            gc_safepoint();
+        }
+    }
+    state.SetItemsProcessed(kBatch * state.iterations());
+}
+BENCHMARK(BM_GcSafepoint);
+
+// big root array of counters and nulls with few pointers, like a table of handles. Arg 1
+// registers it as an unchanging hinted root, only its pointers are scanned after the first cycle
+static void BM_GcCollectSparseRoots(benchmark::State& state) {
+    gc_disable_auto();
+    const size_t num_words = 1 << 20;
+    const size_t pointer_every = 100;
+    std::mt19937 gen(kSeed);
+    std::vector<uintptr_t> words(num_words);
+    for (size_t i = 0; i < num_words; ++i) {
+        if (i % pointer_every == 0) {
+            words[i] = reinterpret_cast<uintptr_t>(gc_malloc_default(64));
+        } else if (i % 2 == 0) {
+            words[i] = gen() % 100000;
+        }
+    }
+    GCRoot root = {words.data(), words.size() * sizeof(uintptr_t)};
+    GCRootHandle handle = nullptr;
+    if (state.range(0)) {
+        gc_init(nullptr, 0);
+        handle = gc_register_root(root.addr, root.size, GC_ROOT_HINTED);
+    } else {
+        gc_init(&root, 1);
+    }
+    for (auto _ : state) {
+        gc_collect_blocked();
+    }
+    state.SetBytesProcessed(num_words * sizeof(uintptr_t) * state.iterations());
+    if (handle != nullptr) {
+        gc_unregister_root(handle);
+    }
+    gc_init(nullptr, 0);
+}
+BENCHMARK(BM_GcCollectSparseRoots)
+    ->Arg(0)
+    ->Arg(1)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// a root registered and unregistered per request, Arg 1 collects in a loop meanwhile
+static void BM_GcRegisterRoot(benchmark::State& state) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    std::atomic<bool> running = true;
+    std::thread collector;
+    if (state.range(0)) {
+        collector = std::thread([&running]() {
+            while (running) {
+                gc_collect_blocked();
+            }
+        });
+    }
+    void* context[4] = {};
+    for (auto _ : state) {
+        GCRootHandle handle = gc_register_root(context, sizeof(context), 0);
+        benchmark::DoNotOptimize(handle);
+        gc_unregister_root(handle);
+    }
+    running = false;
+    if (collector.joinable()) {
+        collector.join();
+    }
+}
+BENCHMARK(BM_GcRegisterRoot)->Arg(0)->Arg(1)->UseRealTime();
+
+// dense root array of pointers into medium objects, in allocation order or shuffled
+static void BM_GcCollectMediumRoots(benchmark::State& state) {
+    gc_disable_auto();
+    const size_t num_objects = 1 << 17;
+    std::vector<void*> objects(num_objects);
+    for (void*& object : objects) {
+        object = gc_calloc_default(1, 2304);
+    }
+    if (state.range(0)) {
+        std::shuffle(objects.begin(), objects.end(), std::mt19937(kSeed));
+    }
+    GCRoot root = {objects.data(), objects.size() * sizeof(void*)};
+    gc_init(&root, 1);
+    for (auto _ : state) {
+        gc_collect_blocked();
+    }
+    state.SetItemsProcessed(num_objects * state.iterations());
+    gc_init(nullptr, 0);
+    gc_collect_blocked();
+}
+BENCHMARK(BM_GcCollectMediumRoots)
+    ->Arg(0)
+    ->Arg(1)
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->Unit(benchmark::kMicrosecond);
+
 static void BM_GcSimulateActions(benchmark::State& state) {
     gc_disable_auto();
     PerformMemoryActions<true>(state, 10000, 64, 1024);
@@ -120,4 +606,68 @@ BENCHMARK(BM_GcSimulateActions)
     ->MeasureProcessCPUTime()
     ->Unit(benchmark::kMicrosecond);
 
+struct MarkNode {
+    MarkNode* left;
+    MarkNode* right;
+};
+
+// small nodes scattered over the heap, so following a pointer misses the cache
+static std::vector<MarkNode*> AllocateMarkNodes(size_t num_nodes, bool shuffled) {
+    std::vector<MarkNode*> nodes(num_nodes);
+    for (size_t i = 0; i < num_nodes; ++i) {
+        nodes[i] = static_cast<MarkNode*>(gc_calloc_default(1, sizeof(MarkNode)));
+    }
+    if (shuffled) {
+        std::shuffle(nodes.begin(), nodes.end(), std::mt19937(kSeed));
+    }
+    return nodes;
+}
+
+static void RunMarkBenchmark(benchmark::State& state, MarkNode* head, size_t num_nodes) {
+    GCRoot root = {&head, sizeof(head)};
+    gc_init(&root, 1);
+    for (auto _ : state) {
+        gc_collect_blocked();
+    }
+    state.SetItemsProcessed(num_nodes * state.iterations());
+    gc_init(nullptr, 0);
+    gc_collect_blocked();
+}
+
+// binary tree of small nodes, only its root is in the root set
+static void BM_GcMarkTree(benchmark::State& state) {
+    gc_disable_auto();
+    const size_t num_nodes = state.range(0);
+    std::vector<MarkNode*> nodes = AllocateMarkNodes(num_nodes, state.range(1));
+    for (size_t i = 1; i < num_nodes; ++i) {
+        MarkNode* parent = nodes[(i - 1) / 2];
+        (i % 2 ? parent->left : parent->right) = nodes[i];
+    }
+    RunMarkBenchmark(state, nodes[0], num_nodes);
+}
+BENCHMARK(BM_GcMarkTree)
+    ->Args({1 << 16, 0})
+    ->Args({1 << 20, 0})
+    ->Args({1 << 20, 1})
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// singly linked list, every node depends on the load of the one before
+static void BM_GcMarkList(benchmark::State& state) {
+    gc_disable_auto();
+    const size_t num_nodes = state.range(0);
+    std::vector<MarkNode*> nodes = AllocateMarkNodes(num_nodes, state.range(1));
+    for (size_t i = 1; i < num_nodes; ++i) {
+        nodes[i - 1]->left = nodes[i];
+    }
+    RunMarkBenchmark(state, nodes[0], num_nodes);
+}
+BENCHMARK(BM_GcMarkList)
+    ->Args({1 << 20, 0})
+    ->Args({1 << 20, 1})
+    ->UseRealTime()
+    ->MeasureProcessCPUTime()
+    ->Unit(benchmark::kMicrosecond);
+
 BENCHMARK_MAIN();
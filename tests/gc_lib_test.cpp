@@ -1,6 +1,10 @@
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstddef>
 #include <thread>
+#include <vector>
 #include <gtest/gtest.h>
 #include "gc.h"
 #include "utils.h"
@@ -186,4 +190,671 @@ TEST(GСLibTest, Realloc) {
     for (int i = 0; i < 8; i++) {
         ASSERT_EQ(ptr[i], i);
     }
-}
\ No newline at end of file
+}
+TEST(GСLibTest, MixedSizesCollected) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    ResetCounter();
+
+    constexpr size_t kSizes[] = {1, 16, 17, 100, 256, 1000, 2048, 2049, 10000};
+    for (size_t size : kSizes) {
+        for (int i = 0; i < 100; ++i) {
+            char* ptr = static_cast<char*>(gc_malloc(size, CounterFinalizer));
+            ptr[size - 1] = 'x';
+        }
+    }
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), 100 * std::size(kSizes));
+}
+
+TEST(GСLibTest, ReallocAcrossSizeClasses) {
+    gc_disable_auto();
+    char* ptr;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&ptr), sizeof(void*)}};
+    gc_init(roots, 1);
+
+    ptr = static_cast<char*>(gc_malloc_default(8));
+    size_t size = 8;
+    for (size_t i = 0; i < size; ++i) {
+        ptr[i] = static_cast<char>(i);
+    }
+    for (size_t new_size : {100, 2000, 5000, 1000}) {
+        ptr = static_cast<char*>(gc_realloc_default(ptr, new_size));
+        for (size_t i = size; i < new_size; ++i) {
+            ptr[i] = static_cast<char>(i);
+        }
+        size = new_size;
+    }
+    gc_collect_blocked();
+    for (size_t i = 0; i < size; ++i) {
+        ASSERT_EQ(ptr[i], static_cast<char>(i));
+    }
+}
+
+TEST(GСLibTest, LargeObjectsCollected) {
+    gc_disable_auto();
+    ResetCounter();
+    char* kept;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&kept), sizeof(kept)}};
+    gc_init(roots, 1);
+
+    constexpr size_t kLarge = 4 * 1024 * 1024;
+    constexpr int kObjects = 10;
+    for (int i = 0; i < kObjects; ++i) {
+        char* ptr = static_cast<char*>(gc_calloc(kLarge, 1, CounterFinalizer));
+        ASSERT_EQ(ptr[kLarge - 1], 0);
+        ptr[0] = static_cast<char>(i);
+        kept = ptr;
+    }
+    char* interior = kept + kLarge / 2;
+    kept = interior;
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), kObjects - 1);
+    ASSERT_EQ(interior[-static_cast<ptrdiff_t>(kLarge / 2)], kObjects - 1);
+
+    kept = nullptr;
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), kObjects);
+}
+
+TEST(GСLibTest, LargeRealloc) {
+    gc_disable_auto();
+    size_t* ptr;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&ptr), sizeof(void*)}};
+    gc_init(roots, 1);
+
+    size_t count = 1000;
+    ptr = static_cast<size_t*>(gc_malloc_default(count * sizeof(size_t)));
+    for (size_t i = 0; i < count; ++i) {
+        ptr[i] = i;
+    }
+    for (size_t new_count : {100000, 1000000, 50000, 100}) {
+        ptr = static_cast<size_t*>(gc_realloc_default(ptr, new_count * sizeof(size_t)));
+        for (size_t i = count; i < new_count; ++i) {
+            ptr[i] = i;
+        }
+        count = new_count;
+        gc_collect_blocked();
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_EQ(ptr[i], i);
+        }
+    }
+}
+
+extern "C" {
+static void AllocatingFinalizer(void*, size_t) {
+    gc_malloc(16, CounterFinalizer);
+    ++GetCounter();
+}
+}
+
+TEST(GСLibTest, FreeFinalizesOutsideTheLock) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    ResetCounter();
+    // a small, a medium and a large object
+    for (size_t size : {size_t{64}, size_t{2304}, size_t{1} << 20}) {
+        gc_free(gc_malloc(size, AllocatingFinalizer));
+    }
+    ASSERT_EQ(GetCounter(), 3);
+}
+
+TEST(GСLibTest, ReallocLeavesInteriorPointersAlone) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    for (size_t size : {size_t{64}, size_t{2304}, size_t{1} << 20}) {
+        char* ptr = static_cast<char*>(gc_malloc_default(size));
+        ptr[0] = 1;
+        ASSERT_EQ(gc_realloc_default(ptr + 8, 2 * size), nullptr);
+        ASSERT_EQ(ptr[0], 1);
+        gc_free(ptr);
+    }
+}
+
+extern "C" {
+static std::atomic<bool> finalizer_entered;
+static std::atomic<bool> finalizer_released;
+
+static void BlockingFinalizer(void*, size_t) {
+    finalizer_entered = true;
+    while (!finalizer_released) {
+        std::this_thread::yield();
+    }
+}
+}
+
+TEST(GСLibTest, ReallocLeavesObjectsBeingFreedAlone) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    // medium objects leave the table before the finalizer runs, they are unknown pointers by then
+    for (size_t size : {size_t{64}, size_t{2304}, size_t{1} << 20}) {
+        finalizer_entered = false;
+        finalizer_released = false;
+        void* ptr = gc_malloc(size, BlockingFinalizer);
+        std::thread freeing([ptr] { gc_free(ptr); });
+        while (!finalizer_entered) {
+            std::this_thread::yield();
+        }
+        void* new_ptr = gc_realloc_default(ptr, 2 * size);
+        finalizer_released = true;
+        freeing.join();
+        ASSERT_EQ(new_ptr, nullptr);
+    }
+}
+
+TEST(GСLibTest, MinorCollectionKeepsOldObjects) {
+    gc_disable_auto();
+    Node* old_node;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&old_node), sizeof(old_node)}};
+    gc_init(roots, 1);
+
+    old_node = static_cast<Node*>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+    Node* old_garbage = static_cast<Node*>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+    old_garbage->value = 1;
+    old_node->next = old_garbage;
+    gc_collect_blocked();
+    ResetCounter();
+    gc_enable_generational();
+    GCStats before;
+    gc_get_stats(&before);
+
+    // the only reference to a young object is in an old one, the barrier makes it visible
+    Node* young = static_cast<Node*>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+    young->value = 42;
+    old_node->next = young;
+    gc_write_barrier(old_node, &old_node->next);
+    constexpr int kGarbage = 100;
+    for (int i = 0; i < kGarbage; ++i) {
+        gc_calloc(1, sizeof(Node), CounterFinalizer);
+    }
+    gc_collect_minor();
+    gc_wait_collect();
+    // old garbage waits for a full collection
+    ASSERT_EQ(GetCounter(), kGarbage);
+    ASSERT_EQ(old_node->next->value, 42);
+
+    GCStats after;
+    gc_get_stats(&after);
+    ASSERT_EQ(after.minor_collections, before.minor_collections + 1);
+    ASSERT_EQ(after.full_collections, before.full_collections);
+
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), kGarbage + 1);
+    ASSERT_EQ(old_node->next->value, 42);
+    gc_disable_generational();
+}
+
+TEST(GСLibTest, MinorCollectionScansDirtyCardsInAllSpaces) {
+    gc_disable_auto();
+    void** holders[3];
+    GCRoot roots[] = {{reinterpret_cast<void*>(holders), sizeof(holders)}};
+    gc_init(roots, 1);
+
+    constexpr size_t kHolderSizes[] = {1024, 16 * 1024, 1024 * 1024};
+    for (size_t i = 0; i < std::size(kHolderSizes); ++i) {
+        holders[i] = static_cast<void**>(gc_calloc(kHolderSizes[i], 1, BasicFinalizer));
+    }
+    gc_collect_blocked();
+    ResetCounter();
+    gc_enable_generational();
+
+    for (size_t i = 0; i < std::size(kHolderSizes); ++i) {
+        // store far from the object start to check that the right card is scanned
+        void** slot = holders[i] + kHolderSizes[i] / sizeof(void*) - 1;
+        *slot = gc_malloc(64, CounterFinalizer);
+        gc_write_barrier(holders[i], slot);
+    }
+    gc_collect_minor();
+    gc_wait_collect();
+    ASSERT_EQ(GetCounter(), 0);
+
+    for (size_t i = 0; i < std::size(kHolderSizes); ++i) {
+        holders[i][kHolderSizes[i] / sizeof(void*) - 1] = nullptr;
+    }
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), std::size(kHolderSizes));
+    gc_disable_generational();
+}
+
+TEST(GСLibTest, MinorCollectionKeepsOldMediumObjects) {
+    gc_disable_auto();
+    char* kept[20];
+    GCRoot roots[] = {{reinterpret_cast<void*>(kept), sizeof(kept)}};
+    gc_init(roots, 1);
+
+    constexpr size_t kMedium = 4096;
+    for (int i = 0; i < 10; ++i) {
+        kept[i] = static_cast<char*>(gc_calloc(1, kMedium, CounterFinalizer));
+    }
+    gc_collect_blocked();
+    ResetCounter();
+    gc_enable_generational();
+
+    // young objects get merged between the old ones, the old ones must stay marked
+    for (int i = 10; i < 20; ++i) {
+        kept[i] = static_cast<char*>(gc_calloc(1, kMedium, CounterFinalizer));
+    }
+    for (int i = 0; i < 20; i += 2) {
+        kept[i] = nullptr;
+    }
+    gc_collect_minor();
+    gc_wait_collect();
+    ASSERT_EQ(GetCounter(), 5);
+
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), 10);
+    gc_disable_generational();
+}
+
+TEST(GСLibTest, MinorCollectionKeepsOldObjectAfterInteriorRealloc) {
+    gc_disable_auto();
+    char** holder;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&holder), sizeof(holder)}};
+    gc_init(roots, 1);
+
+    // the medium object is reachable only through an old small one
+    holder = static_cast<char**>(gc_calloc(1, sizeof(char*), BasicFinalizer));
+    *holder = static_cast<char*>(gc_calloc(1, 4096, CounterFinalizer));
+    (*holder)[0] = 1;
+    gc_collect_blocked();
+    ResetCounter();
+    gc_enable_generational();
+
+    ASSERT_EQ(gc_realloc_default(*holder + 8, 8192), nullptr);
+    gc_collect_minor();
+    gc_wait_collect();
+    ASSERT_EQ(GetCounter(), 0);
+    ASSERT_EQ((*holder)[0], 1);
+    gc_disable_generational();
+    holder = nullptr;
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), 1);
+}
+
+TEST(GСLibTest, DeepLinkedListTracedTransitively) {
+    gc_disable_auto();
+    Node* head = nullptr;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&head), sizeof(head)}};
+    gc_init(roots, 1);
+    gc_collect_blocked();
+    ResetCounter();
+
+    // small nodes with a medium one every 100 and a large one every 2000
+    constexpr int kLength = 10000;
+    for (int i = 0; i < kLength; ++i) {
+        size_t size = i % 2000 == 0 ? 256 * 1024 : i % 100 == 0 ? 4096 : sizeof(Node);
+        Node* node = static_cast<Node*>(gc_calloc(1, size, CounterFinalizer));
+        node->next = head;
+        node->value = i;
+        head = node;
+    }
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), 0);
+    int expected = kLength;
+    for (Node* node = head; node != nullptr; node = node->next) {
+        ASSERT_EQ(node->value, --expected);
+    }
+    ASSERT_EQ(expected, 0);
+
+    head = nullptr;
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), kLength);
+}
+
+TEST(GСLibTest, WorkerThreadsAndAffinity) {
+    gc_disable_auto();
+    Node* head = nullptr;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&head), sizeof(head)}};
+    gc_init(roots, 1);
+    gc_set_worker_threads(4);
+    ASSERT_EQ(gc_get_worker_threads(), 4u);
+    int cpus[] = {0};
+    gc_set_worker_affinity(cpus, 1);
+    // the collecting thread is pinned only until the collection is done
+    cpu_set_t before, after;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(before), &before), 0);
+    gc_collect_blocked();
+    ASSERT_EQ(sched_getaffinity(0, sizeof(after), &after), 0);
+    ASSERT_TRUE(CPU_EQUAL(&before, &after));
+    while (!gc_step(1000)) {
+    }
+    ASSERT_EQ(sched_getaffinity(0, sizeof(after), &after), 0);
+    ASSERT_TRUE(CPU_EQUAL(&before, &after));
+    ResetCounter();
+
+    constexpr int kLength = 5000;
+    for (int i = 0; i < kLength; ++i) {
+        Node* node = static_cast<Node*>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+        node->next = head;
+        node->value = i;
+        head = node;
+    }
+    // the pool is restarted with a different size between collections
+    for (size_t workers : {4, 2, 1, 3}) {
+        gc_set_worker_threads(workers);
+        gc_collect_blocked();
+        ASSERT_EQ(GetCounter(), 0);
+    }
+
+    head = nullptr;
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), kLength);
+
+    gc_set_worker_affinity(nullptr, 0);
+    gc_set_worker_threads(0);
+    ASSERT_GE(gc_get_worker_threads(), 1u);
+}
+
+TEST(GСLibTest, BackgroundSweepKeepsNewObjects) {
+    gc_disable_auto();
+    Node* head = nullptr;
+    Node* fresh = nullptr;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&head), sizeof(head)},
+                      {reinterpret_cast<void*>(&fresh), sizeof(fresh)}};
+    gc_init(roots, 2);
+    gc_enable_background_sweep();
+    gc_collect_blocked();
+    ResetCounter();
+
+    auto make_list = [](int length) {
+        Node* list = nullptr;
+        for (int i = 0; i < length; ++i) {
+            size_t size = i % 500 == 0 ? 256 * 1024 : i % 50 == 0 ? 4096 : sizeof(Node);
+            Node* node = static_cast<Node*>(gc_calloc(1, size, CounterFinalizer));
+            node->next = list;
+            node->value = i;
+            list = node;
+        }
+        return list;
+    };
+    constexpr int kLength = 5000;
+    head = make_list(kLength);
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), 0);
+
+    // objects allocated while the dead list is swept are not marked, yet they must survive it
+    head = nullptr;
+    gc_collect();
+    gc_wait_collect();
+    fresh = make_list(kLength);
+    gc_wait_sweep();
+    ASSERT_EQ(GetCounter(), kLength);
+    int expected = kLength;
+    for (Node* node = fresh; node != nullptr; node = node->next) {
+        ASSERT_EQ(node->value, --expected);
+    }
+    ASSERT_EQ(expected, 0);
+
+    fresh = nullptr;
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), 2 * kLength);
+    gc_disable_background_sweep();
+}
+
+extern "C" {
+static void ValueFinalizer(void* ptr, size_t) {
+    GetCounter() += static_cast<Node*>(ptr)->value;
+}
+}
+
+TEST(GСLibTest, AsyncFinalizersSeeTheirObjects) {
+    gc_disable_auto();
+    Node* head = nullptr;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&head), sizeof(head)}};
+    gc_init(roots, 1);
+    gc_collect_blocked();
+    gc_enable_async_finalizers();
+    gc_set_finalizer_batch_time(100000);
+    ASSERT_EQ(gc_get_finalizer_batch_time(), 100000u);
+    ResetCounter();
+
+    constexpr int kLength = 3000;
+    auto make_list = [] {
+        Node* list = nullptr;
+        for (int i = 1; i <= kLength; ++i) {
+            size_t size = i % 500 == 0 ? 256 * 1024 : i % 50 == 0 ? 4096 : sizeof(Node);
+            auto finalizer = i % 2 == 0 ? ValueFinalizer : BasicFinalizer;
+            Node* node = static_cast<Node*>(gc_calloc(1, size, finalizer));
+            node->next = list;
+            node->value = i;
+            list = node;
+        }
+        return list;
+    };
+    // only objects with a finalizer are queued, and they keep their contents until it ran
+    constexpr int kExpected = kLength / 2 * (kLength / 2 + 1);
+    for (bool background : {false, true}) {
+        if (background) {
+            gc_enable_background_sweep();
+        }
+        ResetCounter();
+        head = make_list();
+        head = nullptr;
+        gc_collect();
+        gc_wait_collect();
+        gc_wait_sweep();
+        gc_run_finalizers();
+        ASSERT_EQ(gc_pending_finalizers(), 0u);
+        ASSERT_EQ(GetCounter(), kExpected);
+        ASSERT_EQ(gc_run_finalizers(), 0u);
+    }
+    gc_disable_background_sweep();
+    gc_disable_async_finalizers();
+    gc_set_finalizer_batch_time(1000000);
+}
+
+TEST(GСLibTest, StepCollectsInBudgetedSlices) {
+    gc_disable_auto();
+    Node* lists[2] = {nullptr, nullptr};
+    GCRoot roots[] = {{reinterpret_cast<void*>(lists), sizeof(lists)}};
+    gc_init(roots, 1);
+    gc_collect_blocked();
+    ResetCounter();
+    // the stepping thread may be a registered one, it doesn't wait for itself to stop
+    gc_register_thread();
+
+    constexpr int kLength = 50000;
+    for (int i = 0; i < kLength; ++i) {
+        size_t size = i % 5000 == 0 ? 256 * 1024 : i % 100 == 0 ? 4096 : sizeof(Node);
+        Node* node = static_cast<Node*>(gc_calloc(1, size, CounterFinalizer));
+        node->next = lists[0];
+        node->value = 1;
+        lists[0] = node;
+    }
+    // the older half is dropped
+    Node* tail = lists[0];
+    for (int i = 1; i < kLength / 2; ++i) {
+        tail = tail->next;
+    }
+    tail->next = nullptr;
+
+    int steps = 0;
+    while (!gc_step(100)) {
+        if (steps++ != 0) {
+            continue;
+        }
+        // the marking hasn't got far yet, the back of the list is only found through the pointer
+        // logged by the barrier
+        Node* cut = lists[0];
+        for (int i = 1; i < kLength / 4; ++i) {
+            cut = cut->next;
+        }
+        gc_write_barrier_pre(&lists[1]);
+        lists[1] = cut->next;
+        gc_write_barrier_pre(&cut->next);
+        cut->next = nullptr;
+    }
+    ASSERT_GT(steps, 1);
+    ASSERT_EQ(GetCounter(), kLength / 2);
+    int total = 0;
+    for (Node* list : lists) {
+        for (Node* node = list; node != nullptr; node = node->next) {
+            ASSERT_EQ(node->value, 1);
+            ++total;
+        }
+    }
+    ASSERT_EQ(total, kLength / 2);
+
+    lists[0] = lists[1] = nullptr;
+    while (!gc_step(1000)) {
+    }
+    ASSERT_EQ(GetCounter(), kLength);
+    gc_deregister_thread();
+}
+
+TEST(GСLibTest, ReallocWhileMarkingKeepsChildren) {
+    gc_disable_auto();
+    constexpr size_t kFillers = 1000;
+    static void* slots[kFillers + 2];
+    GCRoot roots[] = {{reinterpret_cast<void*>(slots), sizeof(slots)}};
+    gc_init(roots, 1);
+    // no thief takes the oldest queued object, the one worker traces the newest first
+    gc_set_worker_threads(1);
+    gc_register_thread();
+
+    // a medium and a large holder, each the only object pointing to its child
+    for (size_t size : {size_t{2304}, size_t{1} << 20}) {
+        void** parent = static_cast<void**>(gc_calloc(2, sizeof(void*), BasicFinalizer));
+        void** holder = static_cast<void**>(gc_calloc(1, size, BasicFinalizer));
+        Node* child = static_cast<Node*>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+        child->value = 5;
+        holder[0] = child;
+        parent[0] = holder;
+        slots[0] = parent;
+        for (size_t i = 2; i < kFillers + 2; ++i) {
+            slots[i] = gc_malloc_default(16);
+        }
+        ResetCounter();
+        ASSERT_FALSE(gc_step(0));
+        // the holder moves to a root slot scanned already, its old place is logged by the
+        // barrier in the buffer of this thread
+        slots[1] = parent[0];
+        gc_write_barrier_pre(&parent[0]);
+        parent[0] = nullptr;
+        slots[1] = gc_realloc(slots[1], 2 * size, BasicFinalizer);
+        while (!gc_step(1000)) {
+        }
+        ASSERT_EQ(GetCounter(), 0);
+        ASSERT_EQ(static_cast<Node*>(static_cast<void**>(slots[1])[0])->value, 5);
+        std::fill(std::begin(slots), std::end(slots), nullptr);
+        while (!gc_step(1000)) {
+        }
+        ASSERT_EQ(GetCounter(), 1);
+    }
+    gc_deregister_thread();
+    gc_set_worker_threads(0);
+}
+
+struct Tagged {
+    Node* node;      // a pointer
+    uintptr_t bits;  // data that happens to look like one
+};
+
+static void FillTagged(Tagged* items, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        items[i].node = static_cast<Node*>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+        items[i].node->value = 1;
+        items[i].bits = reinterpret_cast<uintptr_t>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+    }
+}
+
+TEST(GСLibTest, TypedObjectsScanOnlyPointerWords) {
+    gc_disable_auto();
+    Tagged* kept = nullptr;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&kept), sizeof(kept)}};
+    gc_init(roots, 1);
+    const uint64_t bitmap[] = {0b01};
+    GCDescriptor descriptor = gc_make_descriptor(bitmap, 2);
+    ASSERT_NE(descriptor, nullptr);
+
+    // a small object, a medium and a large array of the type
+    for (size_t count : {size_t{1}, size_t{256}, size_t{16384}}) {
+        kept = static_cast<Tagged*>(
+            gc_malloc_typed(count * sizeof(Tagged), descriptor, BasicFinalizer));
+        FillTagged(kept, count);
+        ResetCounter();
+        gc_collect_blocked();
+        ASSERT_EQ(GetCounter(), static_cast<int>(count));
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_EQ(kept[i].node->value, 1);
+        }
+        kept = nullptr;
+        gc_collect_blocked();
+        ASSERT_EQ(GetCounter(), static_cast<int>(2 * count));
+    }
+}
+
+TEST(GСLibTest, PointerFreeObjectsAreNotScanned) {
+    gc_disable_auto();
+    uintptr_t* kept = nullptr;
+    GCRoot roots[] = {{reinterpret_cast<void*>(&kept), sizeof(kept)}};
+    gc_init(roots, 1);
+
+    for (size_t count : {size_t{8}, size_t{512}, size_t{32768}}) {
+        kept = static_cast<uintptr_t*>(
+            gc_malloc_atomic(count * sizeof(uintptr_t), CounterFinalizer));
+        for (size_t i = 0; i < count; ++i) {
+            kept[i] = reinterpret_cast<uintptr_t>(gc_malloc(sizeof(Node), CounterFinalizer));
+        }
+        ResetCounter();
+        gc_collect_blocked();
+        ASSERT_EQ(GetCounter(), static_cast<int>(count));
+        kept = nullptr;
+        gc_collect_blocked();
+        ASSERT_EQ(GetCounter(), static_cast<int>(count) + 1);
+    }
+}
+
+TEST(GСLibTest, RegisteredRootsKeepObjectsUntilUnregistered) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    ResetCounter();
+    constexpr int kRoots = 1000;
+    static Node* nodes[kRoots];
+    std::vector<GCRootHandle> handles;
+    for (int i = 0; i < kRoots; ++i) {
+        nodes[i] = static_cast<Node*>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+        nodes[i]->value = i;
+        handles.push_back(gc_register_root(&nodes[i], sizeof(nodes[i]), 0));
+    }
+    // every other root goes, the rest keep their places
+    for (int i = 0; i < kRoots; i += 2) {
+        gc_unregister_root(handles[i]);
+    }
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), kRoots / 2);
+    for (int i = 1; i < kRoots; i += 2) {
+        ASSERT_EQ(nodes[i]->value, i);
+        gc_unregister_root(handles[i]);
+    }
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), kRoots);
+}
+
+TEST(GСLibTest, HintedRootRescannedOnlyAfterChange) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    ResetCounter();
+    static Node* table[4096];
+    table[0] = static_cast<Node*>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+    GCRootHandle handle = gc_register_root(table, sizeof(table), GC_ROOT_HINTED);
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), 0);
+
+    // without the hint the words found by the last full scan are scanned again
+    table[0] = nullptr;
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), 0);
+
+    table[4095] = static_cast<Node*>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+    table[4095]->value = 7;
+    gc_root_changed(handle);
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), 1);
+    ASSERT_EQ(table[4095]->value, 7);
+
+    gc_unregister_root(handle);
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), 2);
+    table[4095] = nullptr;
+}
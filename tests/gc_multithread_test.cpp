@@ -1,5 +1,9 @@
+#include <malloc.h>
 #include <chrono>
 #include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
 #include <thread>
 #include <gtest/gtest.h>
 #include "gc.h"
@@ -224,3 +228,476 @@ TEST(MultiThreadGCTest, StaggeredRootLifetimes) {
     ASSERT_TRUE(shared_ptr != nullptr);
     ASSERT_EQ(GetCounter(), 2);
 }
+
+TEST(MultiThreadGCTest, RegisteredThreadsAllocation) {
+    gc_disable_auto();
+    ResetCounter();
+    const int k_alloc_per_thread = 1000;
+    const int k_kept_per_thread = 10;
+    void* kept[kThreads][k_kept_per_thread];
+    GCRoot root = {reinterpret_cast<void*>(kept), sizeof(kept)};
+    gc_init(&root, 1);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&kept, t]() {
+            gc_register_thread();
+            for (int i = 0; i < k_alloc_per_thread; ++i) {
+                // zeroed memory keeps kept objects from retaining others by stale words
+                size_t size = i % 2 == 0 ? 64 : 4096;
+                void* ptr = gc_calloc(1, size, CounterFinalizer);
+                ASSERT_NE(ptr, nullptr);
+                if (i < k_kept_per_thread) {
+                    kept[t][i] = ptr;
+                }
+            }
+            gc_deregister_thread();
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), kThreads * (k_alloc_per_thread - k_kept_per_thread));
+    gc_init(nullptr, 0);
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), kThreads * k_alloc_per_thread);
+}
+
+TEST(MultiThreadGCTest, FreeFromAnotherThreadCache) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    ResetCounter();
+
+    std::vector<void*> pointers;
+    std::thread allocator([&pointers]() {
+        gc_register_thread();
+        for (int i = 0; i < 100; ++i) {
+            pointers.push_back(gc_malloc(i % 2 == 0 ? 32 : 8192, CounterFinalizer));
+        }
+        gc_deregister_thread();
+    });
+    allocator.join();
+
+    for (void* ptr : pointers) {
+        gc_free(ptr);
+    }
+    ASSERT_EQ(GetCounter(), 100);
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), 100);
+}
+
+TEST(MultiThreadGCTest, ConcurrentMarkKeepsMovedObjects) {
+    gc_disable_auto();
+    Node* lists[2] = {nullptr, nullptr};
+    GCRoot roots[] = {{reinterpret_cast<void*>(lists), sizeof(lists)}};
+    gc_init(roots, 1);
+    gc_enable_concurrent_mark();
+    gc_collect_blocked();
+    ResetCounter();
+
+    constexpr int kLength = 30000;
+    for (int i = 0; i < kLength; ++i) {
+        size_t size = i % 5000 == 0 ? 256 * 1024 : i % 100 == 0 ? 4096 : sizeof(Node);
+        Node* node = static_cast<Node*>(gc_calloc(1, size, CounterFinalizer));
+        node->next = lists[0];
+        node->value = 1;
+        lists[0] = node;
+    }
+
+    // moves nodes between the lists while the collections trace them, every overwritten pointer
+    // goes through the barrier, and new nodes are added
+    std::atomic<bool> running = true;
+    std::atomic<int> allocated = 0;
+    std::thread mutator([&] {
+        gc_register_thread();
+        for (int i = 0; running; ++i) {
+            int from = (i / 1000) % 2;
+            Node* node = lists[from];
+            if (node != nullptr) {
+                gc_write_barrier_pre(&lists[from]);
+                lists[from] = node->next;
+                gc_write_barrier_pre(&node->next);
+                node->next = lists[1 - from];
+                gc_write_barrier_pre(&lists[1 - from]);
+                lists[1 - from] = node;
+            }
+            if (i % 10 == 0 && allocated < kLength) {
+                Node* fresh = static_cast<Node*>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+                fresh->value = 1;
+                fresh->next = lists[0];
+                gc_write_barrier_pre(&lists[0]);
+                lists[0] = fresh;
+                ++allocated;
+            }
+            gc_safepoint();
+        }
+        gc_deregister_thread();
+    });
+    for (int i = 0; i < 5; ++i) {
+        gc_collect();
+        gc_wait_collect();
+        gc_wait_sweep();
+    }
+    running = false;
+    mutator.join();
+    ASSERT_EQ(GetCounter(), 0);
+    int total = 0;
+    for (Node* list : lists) {
+        for (Node* node = list; node != nullptr; node = node->next) {
+            ASSERT_EQ(node->value, 1);
+            ++total;
+        }
+    }
+    ASSERT_EQ(total, kLength + allocated);
+
+    lists[0] = lists[1] = nullptr;
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), kLength + allocated);
+    gc_disable_concurrent_mark();
+}
+
+TEST(MultiThreadGCTest, DirtyPageMarkKeepsMovedObjects) {
+    gc_disable_auto();
+    if (!gc_enable_dirty_page_mark()) {
+        GTEST_SKIP() << "the kernel tracks neither soft-dirty bits nor write protected pages";
+    }
+    Node* lists[2] = {nullptr, nullptr};
+    GCRoot roots[] = {{reinterpret_cast<void*>(lists), sizeof(lists)}};
+    gc_init(roots, 1);
+    gc_collect_blocked();
+    ResetCounter();
+
+    constexpr int kLength = 30000;
+    for (int i = 0; i < kLength; ++i) {
+        size_t size = i % 5000 == 0 ? 256 * 1024 : i % 100 == 0 ? 4096 : sizeof(Node);
+        Node* node = static_cast<Node*>(gc_calloc(1, size, CounterFinalizer));
+        node->next = lists[0];
+        node->value = 1;
+        lists[0] = node;
+    }
+
+    // the same moves as with the barrier, only the written pages tell the collector about them
+    std::atomic<bool> running = true;
+    std::atomic<int> allocated = 0;
+    std::thread mutator([&] {
+        gc_register_thread();
+        for (int i = 0; running; ++i) {
+            int from = (i / 1000) % 2;
+            Node* node = lists[from];
+            if (node != nullptr) {
+                lists[from] = node->next;
+                node->next = lists[1 - from];
+                lists[1 - from] = node;
+            }
+            if (i % 10 == 0 && allocated < kLength) {
+                Node* fresh = static_cast<Node*>(gc_calloc(1, sizeof(Node), CounterFinalizer));
+                fresh->value = 1;
+                fresh->next = lists[0];
+                lists[0] = fresh;
+                ++allocated;
+            }
+            gc_safepoint();
+        }
+        gc_deregister_thread();
+    });
+    for (int i = 0; i < 5; ++i) {
+        gc_collect();
+        gc_wait_collect();
+        gc_wait_sweep();
+    }
+    running = false;
+    mutator.join();
+    ASSERT_EQ(GetCounter(), 0);
+    int total = 0;
+    for (Node* list : lists) {
+        for (Node* node = list; node != nullptr; node = node->next) {
+            ASSERT_EQ(node->value, 1);
+            ++total;
+        }
+    }
+    ASSERT_EQ(total, kLength + allocated);
+
+    lists[0] = lists[1] = nullptr;
+    gc_collect_blocked();
+    ASSERT_EQ(GetCounter(), kLength + allocated);
+    gc_disable_dirty_page_mark();
+}
+
+TEST(MultiThreadGCTest, StackRootsOfStoppedThreads) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    if (!gc_enable_stack_roots()) {
+        GTEST_SKIP() << "the suspend signals can't be installed";
+    }
+    gc_collect_blocked();
+    ResetCounter();
+
+    const int per_thread = 100;
+    std::atomic<int> ready = 0;
+    std::atomic<bool> collected = false;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            gc_register_thread();
+            // the pointers are only on the stack, nothing registers them as roots
+            int* volatile local[per_thread];
+            for (int i = 0; i < per_thread; ++i) {
+                local[i] = static_cast<int*>(gc_malloc(sizeof(int), CounterFinalizer));
+                *local[i] = t * 1000 + i;
+            }
+            ++ready;
+            // no safepoint, the collection stops the thread wherever it spins
+            while (!collected) {
+            }
+            for (int i = 0; i < per_thread; ++i) {
+                EXPECT_EQ(*local[i], t * 1000 + i);
+            }
+            gc_deregister_thread();
+        });
+    }
+    while (ready < kThreads) {
+        std::this_thread::yield();
+    }
+    gc_collect_blocked();
+    EXPECT_EQ(GetCounter(), 0);
+    collected = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    gc_collect_blocked();
+    EXPECT_EQ(GetCounter(), kThreads * per_thread);
+    gc_disable_stack_roots();
+}
+
+TEST(MultiThreadGCTest, StackRootsStopThreadsInsideMalloc) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    if (!gc_enable_stack_roots()) {
+        GTEST_SKIP() << "the suspend signals can't be installed";
+    }
+    // one arena for every new thread, so stopped threads often hold the lock the collector's
+    // thread would need. Sizes past the thread cache of malloc take that lock
+    mallopt(M_ARENA_MAX, 1);
+    std::atomic<bool> stop = false;
+    std::atomic<int> ready = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            gc_register_thread();
+            ++ready;
+            for (size_t i = 0; !stop; ++i) {
+                void* volatile ptr = std::malloc(2048 + (i * 64 + t) % 16384);
+                std::free(ptr);
+                if (i % 64 == 0) {
+                    gc_malloc_default(4096);
+                }
+            }
+            gc_deregister_thread();
+        });
+    }
+    while (ready < kThreads) {
+        std::this_thread::yield();
+    }
+    auto collections = std::async(std::launch::async, [] {
+        for (int i = 0; i < 100; ++i) {
+            gc_collect_blocked();
+        }
+    });
+    bool done = collections.wait_for(std::chrono::seconds(30)) == std::future_status::ready;
+    stop = true;
+    if (!done) {
+        // the threads can't be joined, there is nothing to clean up after a deadlock
+        std::fprintf(stderr, "collections deadlocked\n");
+        std::_Exit(1);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    gc_disable_stack_roots();
+}
+
+TEST(MultiThreadGCTest, BlockedThreadsDontStallCollection) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    ResetCounter();
+
+    std::promise<void> wake;
+    std::shared_future<void> woken = wake.get_future().share();
+    std::atomic<int> blocked = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&]() {
+            gc_register_thread();
+            gc_malloc(64, CounterFinalizer);
+            gc_enter_blocking();
+            ++blocked;
+            // blocks without a safepoint until the collection is over
+            woken.wait();
+            gc_leave_blocking();
+            gc_malloc(64, CounterFinalizer);
+            gc_deregister_thread();
+        });
+    }
+    while (blocked < kThreads) {
+        std::this_thread::yield();
+    }
+    gc_collect_blocked();
+    EXPECT_EQ(GetCounter(), kThreads);
+    GCStats stats;
+    gc_get_stats(&stats);
+    EXPECT_GT(stats.last_time_to_safepoint_ns, 0u);
+    EXPECT_GE(stats.max_time_to_safepoint_ns, stats.last_time_to_safepoint_ns);
+    wake.set_value();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    gc_collect_blocked();
+    EXPECT_EQ(GetCounter(), 2 * kThreads);
+}
+
+TEST(MultiThreadGCTest, DroppedBlockedThreadDoesntStandInForRunningOne) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+
+    std::promise<void> wake;
+    std::atomic<bool> blocked = false;
+    std::thread blocking([&]() {
+        gc_register_thread();
+        gc_enter_blocking();
+        blocked = true;
+        wake.get_future().wait();
+        gc_leave_blocking();
+        gc_deregister_thread();
+    });
+    while (!blocked) {
+        std::this_thread::yield();
+    }
+    // the blocked thread is no longer waited for, so it must not count as stopped
+    gc_disable_auto();
+
+    std::atomic<bool> registered = false, running = true;
+    std::thread runner([&]() {
+        gc_register_thread();
+        registered = true;
+        // no safepoint until the collection has had time to finish without it
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        while (running) {
+            gc_safepoint();
+        }
+        gc_deregister_thread();
+    });
+    while (!registered) {
+        std::this_thread::yield();
+    }
+    std::atomic<bool> collected = false;
+    std::thread collector([&]() {
+        gc_collect_blocked();
+        collected = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_FALSE(collected);
+    collector.join();
+    running = false;
+    runner.join();
+    wake.set_value();
+    blocking.join();
+}
+
+TEST(MultiThreadGCTest, PollingSafepointsParkThreads) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    ResetCounter();
+
+    std::atomic<bool> running = true;
+    std::atomic<int> ready = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&]() {
+            gc_register_thread();
+            ++ready;
+            // the loads of the poll page are all that stops the threads
+            while (running) {
+                gc_safepoint();
+            }
+            gc_deregister_thread();
+        });
+    }
+    while (ready < kThreads) {
+        std::this_thread::yield();
+    }
+    const int collections = 5;
+    for (int i = 0; i < collections; ++i) {
+        gc_malloc(64, CounterFinalizer);
+        gc_collect_blocked();
+    }
+    EXPECT_EQ(GetCounter(), collections);
+    running = false;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+extern "C" {
+static void PoisonFinalizer(void* ptr, size_t) {
+    static_cast<Node*>(ptr)->value = -1;
+}
+}
+
+TEST(MultiThreadGCTest, RootsRegisteredDuringCollections) {
+    gc_disable_auto();
+    gc_init(nullptr, 0);
+    std::atomic<int> finished = 0;
+    std::atomic<int> collections = 0;
+    std::atomic<int> lost = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            // registered threads root what they allocate, the others only add and remove roots
+            bool registered = t % 2 == 0;
+            if (registered) {
+                gc_register_thread();
+            }
+            Node* slots[16] = {};
+            // every round of a registered thread waits for a collection
+            const int rounds = registered ? kIterations / 10 : kIterations;
+            for (int i = 0; i < rounds; ++i) {
+                int flags = i % 2 == 0 ? GC_ROOT_HINTED : 0;
+                if (!registered) {
+                    GCRootHandle handle = gc_register_root(slots, sizeof(slots), flags);
+                    std::this_thread::yield();
+                    gc_unregister_root(handle);
+                    continue;
+                }
+                slots[i % 16] = static_cast<Node*>(gc_malloc(sizeof(Node), PoisonFinalizer));
+                slots[i % 16]->value = i;
+                GCRootHandle handle = gc_register_root(slots, sizeof(slots), flags);
+                // the root is held across a whole collection
+                int seen = collections;
+                while (collections < seen + 2) {
+                    gc_safepoint();
+                }
+                if (slots[i % 16]->value != i) {
+                    ++lost;
+                }
+                gc_unregister_root(handle);
+                gc_safepoint();
+            }
+            if (registered) {
+                gc_deregister_thread();
+            }
+            ++finished;
+        });
+    }
+    while (finished < kThreads) {
+        gc_collect_blocked();
+        ++collections;
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(lost, 0);
+}
@@ -0,0 +1,58 @@
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "stealing_queue.h"
+
+struct Task {
+    uint64_t ptr;
+    uint64_t size;
+};
+
+// owner push and pop without thieves, the cost every marked object pays
+static void BM_QueuePushPop(benchmark::State& state) {
+    WorkStealingQueue<Task> queue;
+    const size_t batch = state.range(0);
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch; ++i) {
+            queue.push(Task{i, 64});
+        }
+        Task task;
+        while (queue.pop(task)) {
+            benchmark::DoNotOptimize(task);
+        }
+    }
+    state.SetItemsProcessed(batch * state.iterations());
+}
+BENCHMARK(BM_QueuePushPop)->Arg(16)->Arg(4096);
+
+// one owner producing and consuming work while the other threads steal from it
+static void BM_QueueSteal(benchmark::State& state) {
+    static WorkStealingQueue<Task>* queue = nullptr;
+    if (state.thread_index() == 0) {
+        queue = new WorkStealingQueue<Task>();
+    }
+    // all threads wait for each other before and after the loop
+    for (auto _ : state) {
+        Task task;
+        if (state.thread_index() == 0) {
+            for (uint64_t i = 0; i < 4096; ++i) {
+                queue->push(Task{i, 64});
+            }
+            while (queue->pop(task)) {
+                benchmark::DoNotOptimize(task);
+            }
+        } else {
+            for (int i = 0; i < 4096; ++i) {
+                if (queue->steal(task)) {
+                    benchmark::DoNotOptimize(task);
+                }
+            }
+        }
+    }
+    if (state.thread_index() == 0) {
+        delete queue;
+    }
+}
+BENCHMARK(BM_QueueSteal)->ThreadRange(1, 8)->UseRealTime();
@@ -0,0 +1,76 @@
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "stealing_queue.h"
+
+struct Task {
+    uint64_t id;
+    uint64_t check;
+};
+
+TEST(WorkStealingQueueTest, OwnerIsLifoThievesAreFifo) {
+    WorkStealingQueue<Task> queue(2);
+    for (uint64_t i = 0; i < 10; ++i) {
+        queue.push(Task{i, ~i});
+    }
+    Task task;
+    ASSERT_TRUE(queue.steal(task));
+    EXPECT_EQ(task.id, 0u);
+    ASSERT_TRUE(queue.pop(task));
+    EXPECT_EQ(task.id, 9u);
+    size_t left = 0;
+    while (queue.pop(task)) {
+        EXPECT_EQ(task.check, ~task.id);
+        ++left;
+    }
+    EXPECT_EQ(left, 8u);
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.steal(task));
+}
+
+constexpr uint64_t kTasks = 200000;
+constexpr size_t kThieves = 4;
+
+// The owner keeps pushing and popping while thieves steal, every task must be taken exactly once
+TEST(WorkStealingQueueTest, StressEveryTaskTakenOnce) {
+    WorkStealingQueue<Task> queue(16);
+    std::vector<std::atomic<uint8_t>> taken(kTasks);
+    std::atomic<bool> done = false;
+    auto take = [&taken](const Task& task) {
+        ASSERT_LT(task.id, kTasks);
+        ASSERT_EQ(task.check, ~task.id);
+        ASSERT_EQ(taken[task.id].fetch_add(1), 0) << task.id;
+    };
+
+    std::vector<std::thread> thieves;
+    for (size_t i = 0; i < kThieves; ++i) {
+        thieves.emplace_back([&queue, &done, &take] {
+            Task task;
+            while (!done.load()) {
+                if (queue.steal(task)) {
+                    take(task);
+                }
+            }
+        });
+    }
+    Task task;
+    for (uint64_t i = 0; i < kTasks; ++i) {
+        queue.push(Task{i, ~i});
+        // pop now and then, so the owner and thieves fight over the last elements
+        if (i % 3 == 0 && queue.pop(task)) {
+            take(task);
+        }
+    }
+    while (queue.pop(task)) {
+        take(task);
+    }
+    done = true;
+    for (auto& thief : thieves) {
+        thief.join();
+    }
+    for (uint64_t i = 0; i < kTasks; ++i) {
+        ASSERT_EQ(taken[i].load(), 1) << i;
+    }
+}
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+#include "gc_scan.h"
+
+static std::vector<uintptr_t> Filter(FilterWordsFn filter, const std::vector<uintptr_t>& words,
+                                     size_t offset, uintptr_t min_addr, uintptr_t max_addr) {
+    std::vector<uintptr_t> candidates(words.size());
+    size_t found = filter(words.data() + offset, words.size() - offset, min_addr, max_addr,
+                          candidates.data());
+    candidates.resize(found);
+    return candidates;
+}
+
+TEST(ScanTest, KernelsMatchScalar) {
+    std::mt19937_64 gen(204);
+    constexpr uintptr_t kMin = 0x7f0000001000, kMax = 0x7f0000801000;
+    std::vector<uintptr_t> words(1000);
+    for (uintptr_t& word : words) {
+        switch (gen() % 5) {
+            case 0:
+                word = 0;
+                break;
+            case 1:
+                word = gen() % 1000;
+                break;
+            case 2:
+                word = kMin + gen() % (kMax - kMin);
+                break;
+            case 3:
+                word = gen() % 2 ? kMin - 1 - gen() % 8 : kMax + gen() % 8;
+                break;
+            default:
+                word = gen();
+        }
+    }
+    words[3] = kMin;
+    words[4] = kMax;
+    words[5] = kMax - 1;
+
+    std::vector<FilterWordsFn> kernels = {FilterWords};
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        kernels.push_back(FilterWordsSse42);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back(FilterWordsAvx2);
+    }
+#endif
+    for (size_t offset : {0, 1, 3, 990, 997, 1000}) {
+        std::vector<uintptr_t> expected;
+        for (size_t i = offset; i < words.size(); ++i) {
+            if (kMin <= words[i] && words[i] < kMax) {
+                expected.push_back(words[i]);
+            }
+        }
+        ASSERT_EQ(Filter(FilterWordsScalar, words, offset, kMin, kMax), expected);
+        for (FilterWordsFn kernel : kernels) {
+            ASSERT_EQ(Filter(kernel, words, offset, kMin, kMax), expected) << offset;
+        }
+    }
+}
+
+TEST(ScanTest, ScanWordsReadsUnalignedRanges) {
+    std::vector<uintptr_t> words(2 * kScanBatch + 5, 0);
+    words[0] = 100;
+    words[kScanBatch] = 101;
+    words[words.size() - 1] = 102;
+    // an unaligned start reads words straddling the array elements, none of them fit in range
+    std::vector<uintptr_t> seen;
+    uintptr_t start = reinterpret_cast<uintptr_t>(words.data());
+    uintptr_t end = start + words.size() * sizeof(uintptr_t);
+    ScanWords(start, end, 100, 103, [&seen](uintptr_t word) { seen.push_back(word); });
+    EXPECT_EQ(seen, (std::vector<uintptr_t>{100, 101, 102}));
+    seen.clear();
+    ScanWords(start + 1, end, 100, 103, [&seen](uintptr_t word) { seen.push_back(word); });
+    EXPECT_TRUE(seen.empty());
+    ScanWords(start, end - 1, 100, 103, [&seen](uintptr_t word) { seen.push_back(word); });
+    EXPECT_EQ(seen, (std::vector<uintptr_t>{100, 101}));
+}
+
+TEST(ScanTest, SortAddressesMatchesSort) {
+    std::mt19937_64 gen(204);
+    std::vector<uintptr_t> scratch;
+    for (size_t count : {0, 1, 10, 255, 256, 1000, 5000}) {
+        for (uintptr_t mask : {uintptr_t{0xffff}, uintptr_t{0xffffff0}, ~uintptr_t{0}}) {
+            std::vector<uintptr_t> keys(count);
+            for (uintptr_t& key : keys) {
+                key = 0x7f0000000000 | (gen() & mask);
+            }
+            std::vector<uintptr_t> expected = keys;
+            std::sort(expected.begin(), expected.end());
+            SortAddresses(&keys, &scratch);
+            ASSERT_EQ(keys, expected) << count << " " << mask;
+        }
+    }
+}